@@ -0,0 +1,184 @@
+/*
+ * Registers the BPF port of Davis (tcp_davis.bpf.c) as a congestion
+ * control under a chosen name and set of parameters. The registration
+ * outlives the loader; unregister it with bpftool using the printed map
+ * id.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "davis_core.h"
+#include "tcp_davis.skel.h"
+
+
+// From include/net/tcp.h, which userspace can't include.
+#define TCP_CA_NAME_MAX 16
+#define TCP_CONG_NEEDS_ECN 0x2
+
+
+// Named as the net.ipv4.tcp_davis sysctls, plus ecn.
+static const struct {
+    const char *name;
+    size_t offset;
+} params_table[] = {
+    { "reactivity", offsetof(struct davis_params, reactivity) },
+    { "sensitivity", offsetof(struct davis_params, sensitivity) },
+    { "stable_rtts_min", offsetof(struct davis_params, stable_rtts_min) },
+    { "stable_rtts_max", offsetof(struct davis_params, stable_rtts_max) },
+    { "min_gain_cwnd", offsetof(struct davis_params, min_gain_cwnd) },
+    { "rtt_timeout_ms", offsetof(struct davis_params, rtt_timeout_ms) },
+    { "pacing_gain_slow_start", offsetof(struct davis_params, pacing_gain_slow_start) },
+    { "pacing_gain_drain", offsetof(struct davis_params, pacing_gain_drain) },
+    { "pacing_gain_stable", offsetof(struct davis_params, pacing_gain_stable) },
+    { "pacing_gain_probe", offsetof(struct davis_params, pacing_gain_probe) },
+    { "startup", offsetof(struct davis_params, startup) },
+    { "ecn", offsetof(struct davis_params, ecn) },
+};
+
+
+static void usage(FILE *out, const char *prog)
+{
+    size_t i;
+
+    fprintf(out,
+            "Usage: %s [-n NAME] [PARAM=VALUE]...\n"
+            "\n"
+            "Register the BPF port of Davis as congestion control NAME\n"
+            "(default bpf_davis). Parameters are in the same units as the\n"
+            "module's, and default to its defaults:\n"
+            "\n",
+            prog);
+
+    for (i = 0; i < sizeof(params_table)/sizeof(params_table[0]); i++)
+        fprintf(out, "  %s\n", params_table[i].name);
+
+    fprintf(out,
+            "\n"
+            "Select it with TCP_CONGESTION or net.ipv4.tcp_congestion_control,\n"
+            "and remove it with bpftool struct_ops unregister id ID.\n");
+}
+
+
+static bool parse_param(struct davis_params *params, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    unsigned long value;
+    char *end;
+    size_t i;
+
+    if (eq == NULL) {
+        fprintf(stderr, "davis_loader: expected PARAM=VALUE, got %s\n", arg);
+        return false;
+    }
+
+    errno = 0;
+    value = strtoul(eq + 1, &end, 0);
+    if (errno != 0 || end == eq + 1 || *end != '\0' || value > U32_MAX) {
+        fprintf(stderr, "davis_loader: bad value in %s\n", arg);
+        return false;
+    }
+
+    for (i = 0; i < sizeof(params_table)/sizeof(params_table[0]); i++) {
+        if (strlen(params_table[i].name) == (size_t) (eq - arg)
+            && strncmp(params_table[i].name, arg, eq - arg) == 0) {
+            *(u32 *) ((char *) params + params_table[i].offset) = value;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "davis_loader: unknown parameter in %s\n", arg);
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct davis_params params = DAVIS_PARAMS_INIT;
+    char name[TCP_CA_NAME_MAX] = "bpf_davis";
+    struct bpf_map_info info = { 0 };
+    __u32 info_len = sizeof(info);
+    struct tcp_davis_bpf *skel;
+    struct bpf_link *link;
+    const char *err;
+    int opt, ret = 1;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            if (strlen(optarg) >= sizeof(name)) {
+                fprintf(stderr, "davis_loader: name must be under %zu characters\n",
+                        sizeof(name));
+                return 1;
+            }
+            strcpy(name, optarg);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    for (; optind < argc; optind++) {
+        if (!parse_param(&params, argv[optind]))
+            return 1;
+    }
+
+    // The kernel won't check these, so this is the only chance.
+    err = davis_params_check(&params);
+    if (err != NULL) {
+        fprintf(stderr, "davis_loader: %s\n", err);
+        return 1;
+    }
+
+    skel = tcp_davis_bpf__open();
+    if (skel == NULL) {
+        fprintf(stderr, "davis_loader: failed to open BPF object: %s\n",
+                strerror(errno));
+        return 1;
+    }
+
+    skel->rodata->davis_params = params;
+
+    // Through the skeleton's shadow of the struct_ops map, which needs
+    // libbpf 1.3 and a bpftool as recent.
+    memcpy(skel->struct_ops.davis_ops->name, name, sizeof(name));
+    skel->struct_ops.davis_ops->flags = params.ecn ? TCP_CONG_NEEDS_ECN : 0;
+
+    if (tcp_davis_bpf__load(skel) != 0) {
+        fprintf(stderr, "davis_loader: failed to load BPF object: %s\n",
+                strerror(errno));
+        goto out;
+    }
+
+    link = bpf_map__attach_struct_ops(skel->maps.davis_ops);
+    if (link == NULL) {
+        fprintf(stderr, "davis_loader: failed to register %s: %s\n",
+                name, strerror(errno));
+        goto out;
+    }
+
+    // Keep the registration when the link goes away with the loader.
+    bpf_link__disconnect(link);
+    bpf_link__destroy(link);
+
+    bpf_obj_get_info_by_fd(bpf_map__fd(skel->maps.davis_ops), &info, &info_len);
+    printf("registered %s, struct_ops map id %u\n", name, info.id);
+    ret = 0;
+
+out:
+    tcp_davis_bpf__destroy(skel);
+    return ret;
+}
@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Davis congestion control as a BPF struct_ops
+ *
+ * The same state machine as tcp_davis.c, from davis_core.h, but
+ * registered from userspace by davis_loader. Variants with different
+ * parameters can then be registered side by side under different names,
+ * compared on live traffic and removed, without reloading the module or
+ * touching other connections. Tracepoints and inet_diag aren't
+ * available to struct_ops programs, so this has neither.
+ */
+
+#include "vmlinux.h"
+
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "davis_core.h"
+
+
+char _license[] SEC("license") = "GPL";
+
+// Macros vmlinux.h can't carry.
+#define NSEC_PER_USEC 1000UL
+#define TCP_ECN_DEMAND_CWR 4
+
+extern unsigned int CONFIG_HZ __kconfig;
+
+// Set by davis_loader before loading, after checking them with
+// davis_params_check(). Being read only, the verifier sees them as
+// constants.
+const volatile struct davis_params davis_params = DAVIS_PARAMS_INIT;
+
+_Static_assert(sizeof(struct davis)
+               <= sizeof(((struct inet_connection_sock *) 0)->icsk_ca_priv),
+               "struct davis must fit in icsk_ca_priv");
+
+
+static inline const struct davis_params *davis_get_params(void)
+{
+    return (const struct davis_params *) &davis_params;
+}
+
+
+static inline struct tcp_sock *tcp_sk(const struct sock *sk)
+{
+    return (struct tcp_sock *) sk;
+}
+
+
+static inline struct inet_connection_sock *inet_csk(const struct sock *sk)
+{
+    return (struct inet_connection_sock *) sk;
+}
+
+
+static inline struct davis *davis_ca(const struct sock *sk)
+{
+    return (struct davis *) inet_csk(sk)->icsk_ca_priv;
+}
+
+
+static inline u64 davis_current_time(const struct sock *sk)
+{
+    return tcp_sk(sk)->tcp_clock_cache/NSEC_PER_USEC;
+}
+
+
+static void davis_update_pacing_rate(struct sock *sk)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u64 rate = davis_pacing_rate(davis, davis_get_params(), tp->snd_cwnd,
+                                 tp->snd_ssthresh, tp->mss_cache);
+
+    // Until there is a min RTT, pace the window over the handshake RTT
+    // (or 1ms without one) at the slow start gain.
+    if (rate == 0) {
+        u32 rtt_us = tp->srtt_us ? max_t(u32, tp->srtt_us >> 3, 1) : USEC_PER_MSEC;
+
+        rate = (u64) tp->snd_cwnd*tp->mss_cache*USEC_PER_SEC/rtt_us;
+        rate = (rate*davis_get_params()->pacing_gain_slow_start) >> DAVIS_SHIFT;
+    }
+
+    sk->sk_pacing_rate = min_t(u64, rate, sk->sk_max_pacing_rate);
+}
+
+
+// rs may be NULL when there is no ACK to take a rate sample from.
+static void davis_fill_ack(struct sock *sk, u64 now, u32 rtt,
+                           const struct rate_sample *rs,
+                           struct davis_ack *ack)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+
+    ack->now = now;
+    ack->rtt = rtt;
+    ack->app_limited = tp->app_limited != 0;
+
+    ack->acked = rs != NULL ? rs->acked_sacked : 0;
+    ack->ce = davis->ece ? ack->acked : 0;
+
+    if (rs != NULL && rs->delivered > 0 && rs->interval_us > 0) {
+        ack->delivered = rs->delivered;
+        ack->interval = rs->interval_us;
+        ack->app_limited |= rs->is_app_limited;
+    } else {
+        ack->delivered = 0;
+        ack->interval = 0;
+    }
+}
+
+
+// The struct_ops callbacks mirror the module's. The core works on
+// copies of snd_cwnd and snd_ssthresh, since pointers into tcp_sock
+// can't be handed around.
+
+SEC("struct_ops/davis_init")
+void BPF_PROG(davis_init, struct sock *sk)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u32 cwnd = tp->snd_cwnd, ssthresh = tp->snd_ssthresh;
+    struct davis_ack ack;
+
+    davis_fill_ack(sk, davis_current_time(sk), 0, NULL, &ack);
+    davis_core_init(davis, davis_get_params(), &ack, &cwnd, &ssthresh);
+    tp->snd_cwnd = cwnd;
+    tp->snd_ssthresh = ssthresh;
+
+    // As the module does, since fq can set SK_PACING_FQ under us.
+    __sync_val_compare_and_swap(&sk->sk_pacing_status, SK_PACING_NONE,
+                                SK_PACING_NEEDED);
+    davis_update_pacing_rate(sk);
+}
+
+
+SEC("struct_ops/davis_ssthresh")
+u32 BPF_PROG(davis_ssthresh, struct sock *sk)
+{
+    return tcp_sk(sk)->snd_ssthresh;
+}
+
+
+// See tcp_davis_set_state().
+SEC("struct_ops/davis_set_state")
+void BPF_PROG(davis_set_state, struct sock *sk, u8 new_state)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u32 cwnd = tp->snd_cwnd, ssthresh = tp->snd_ssthresh;
+    u8 old_state = BPF_CORE_READ_BITFIELD(inet_csk(sk), icsk_ca_state);
+
+    if (new_state != TCP_CA_Recovery && new_state != TCP_CA_Loss)
+        return;
+    if (old_state == TCP_CA_Recovery || old_state == TCP_CA_Loss)
+        return;
+
+    davis_core_on_loss(davis, davis_get_params(), davis_current_time(sk),
+                       &cwnd, &ssthresh);
+    tp->snd_cwnd = cwnd;
+    tp->snd_ssthresh = ssthresh;
+    davis_update_pacing_rate(sk);
+}
+
+
+SEC("struct_ops/davis_cwnd_event")
+void BPF_PROG(davis_cwnd_event, struct sock *sk, enum tcp_ca_event ev)
+{
+    struct tcp_sock *tp = tcp_sk(sk);
+
+    if (!davis_get_params()->ecn)
+        return;
+
+    if (ev == CA_EVENT_ECN_IS_CE)
+        tp->ecn_flags |= TCP_ECN_DEMAND_CWR;
+    else if (ev == CA_EVENT_ECN_NO_CE)
+        tp->ecn_flags &= ~TCP_ECN_DEMAND_CWR;
+}
+
+
+SEC("struct_ops/davis_in_ack_event")
+void BPF_PROG(davis_in_ack_event, struct sock *sk, u32 flags)
+{
+    struct davis *davis = davis_ca(sk);
+
+    davis->ece = davis_get_params()->ecn && (flags & CA_ACK_ECE);
+}
+
+
+SEC("struct_ops/davis_undo_cwnd")
+u32 BPF_PROG(davis_undo_cwnd, struct sock *sk)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u32 cwnd = tp->snd_cwnd;
+
+    davis_core_undo(davis, davis_current_time(sk), &cwnd);
+    tp->snd_cwnd = cwnd;
+    davis_update_pacing_rate(sk);
+
+    return cwnd;
+}
+
+
+SEC("struct_ops/davis_cong_control")
+void BPF_PROG(davis_cong_control, struct sock *sk, const struct rate_sample *rs)
+{
+    struct davis *davis = davis_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u32 cwnd = tp->snd_cwnd, ssthresh = tp->snd_ssthresh;
+    struct davis_ack ack;
+    s32 rtt;
+
+    // See tcp_davis_cong_control() for why tiny RTT samples are
+    // replaced by the smoothed RTT.
+    if (rs->rtt_us > (long) (USEC_PER_SEC/CONFIG_HZ))
+        rtt = rs->rtt_us;
+    else
+        rtt = tp->srtt_us;
+
+    davis_fill_ack(sk, davis_current_time(sk), max_t(s32, rtt, 0), rs, &ack);
+    davis_core_on_ack(davis, davis_get_params(), &ack, &cwnd, &ssthresh);
+    tp->snd_cwnd = cwnd;
+    tp->snd_ssthresh = ssthresh;
+    davis_update_pacing_rate(sk);
+}
+
+
+// davis_loader renames this and sets TCP_CONG_NEEDS_ECN in flags as
+// needed before loading.
+SEC(".struct_ops")
+struct tcp_congestion_ops davis_ops = {
+    .init         = (void *) davis_init,
+    .ssthresh     = (void *) davis_ssthresh,
+    .set_state    = (void *) davis_set_state,
+    .undo_cwnd    = (void *) davis_undo_cwnd,
+    .cwnd_event   = (void *) davis_cwnd_event,
+    .in_ack_event = (void *) davis_in_ack_event,
+    .cong_control = (void *) davis_cong_control,
+    .name         = "bpf_davis",
+};
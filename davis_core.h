@@ -0,0 +1,864 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Davis congestion control state machine
+ *
+ * This is shared by the kernel module (tcp_davis.c), the BPF struct_ops
+ * port (bpf/tcp_davis.bpf.c) and the simulator (simulation/davis.c), so
+ * that simulated runs take exactly the same decisions the module would.
+ * Everything is fixed point: times are in microseconds, windows are in
+ * packets, and tunables are scaled by DAVIS_ONE.
+ */
+
+#ifndef _DAVIS_CORE_H_
+#define _DAVIS_CORE_H_
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+
+#include <net/tcp.h>
+
+#define davis_err(fmt, ...) printk(KERN_ERR "tcp_davis: " fmt, ##__VA_ARGS__)
+
+#elif defined(__bpf__)
+
+// vmlinux.h and bpf_helpers.h must come first. They provide the kernel
+// types, but none of the kernel's macros.
+
+#ifndef NULL
+#define NULL ((void *) 0)
+#endif
+
+#define U8_MAX ((u8) ~0U)
+#define U32_MAX ((u32) ~0U)
+#define MSEC_PER_SEC 1000UL
+#define USEC_PER_MSEC 1000UL
+#define USEC_PER_SEC 1000000UL
+
+#define MAX_TCP_WINDOW 32767U
+#define TCP_INFINITE_SSTHRESH 0x7fffffff
+
+#define DIV_ROUND_UP_ULL(ll, d) (((u64) (ll) + (d) - 1)/(d))
+#define div_u64(dividend, divisor) ((u64) (dividend)/(u32) (divisor))
+#define min_t(type, x, y) ((type) (x) < (type) (y) ? (type) (x) : (type) (y))
+#define max_t(type, x, y) ((type) (x) > (type) (y) ? (type) (x) : (type) (y))
+#define clamp_t(type, val, lo, hi) max_t(type, lo, min_t(type, val, hi))
+
+#define davis_err(fmt, ...) bpf_printk("tcp_davis: " fmt, ##__VA_ARGS__)
+
+#else
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define U8_MAX UINT8_MAX
+#define U32_MAX UINT32_MAX
+#define MSEC_PER_SEC 1000UL
+#define USEC_PER_MSEC 1000UL
+#define USEC_PER_SEC 1000000UL
+
+#define MAX_TCP_WINDOW 32767U
+#define TCP_INFINITE_SSTHRESH 0x7fffffff
+
+#define DIV_ROUND_UP_ULL(ll, d) (((u64) (ll) + (d) - 1)/(d))
+#define div_u64(dividend, divisor) ((u64) (dividend)/(u32) (divisor))
+#define min_t(type, x, y) ((type) (x) < (type) (y) ? (type) (x) : (type) (y))
+#define max_t(type, x, y) ((type) (x) > (type) (y) ? (type) (x) : (type) (y))
+#define clamp_t(type, val, lo, hi) max_t(type, lo, min_t(type, val, hi))
+
+#define davis_err(fmt, ...) fprintf(stderr, "tcp_davis: " fmt, ##__VA_ARGS__)
+
+#endif /* __KERNEL__, __bpf__ */
+
+#include "win_minmax.h"
+
+
+// Tracing hooks, called at every mode transition, BDP sample and gain
+// update. They compile to nothing unless the includer defines them
+// first, as tcp_davis.c does with the tracepoints in davis_trace.h.
+#ifndef davis_trace_mode
+#define davis_trace_mode(davis, new_mode) do { } while (0)
+#endif
+
+#ifndef davis_trace_bdp
+#define davis_trace_bdp(davis, diff_deliv, interval) do { } while (0)
+#endif
+
+#ifndef davis_trace_gain_cwnd
+#define davis_trace_gain_cwnd(davis) do { } while (0)
+#endif
+
+
+#define DAVIS_SHIFT 10
+#define DAVIS_ONE (1 << DAVIS_SHIFT)
+
+static const u32 MIN_CWND = 4;
+static const u32 MAX_CWND = MAX_TCP_WINDOW;
+
+static const u32 DRAIN_RTTS = 2;
+static const u32 GAIN_1_RTTS = 2;
+static const u32 GAIN_2_RTTS = 1;
+
+static const u32 RTT_INF = U32_MAX;
+
+// An RTT this fraction above the min RTT means there is a queue.
+static const u32 MIN_RTT_SLACK = DAVIS_ONE/8;
+
+// A congestive loss, see davis_congestive_loss(), backs the max delivery
+// rate, and with it the BDP, off to LOSS_BETA. Other losses are taken as
+// random and ignored.
+static const u32 LOSS_BETA = 7*DAVIS_ONE/10;
+
+// Fast startup takes the pipe as full once the BDP has grown by less
+// than STARTUP_GROWTH for STARTUP_FULL_ROUNDS round trips in a row.
+static const u32 STARTUP_GROWTH = 5*DAVIS_ONE/4;
+static const u32 STARTUP_FULL_ROUNDS = 3;
+
+// Delivery rates are in packets per microsecond, scaled by BW_UNIT, and
+// the BDP comes from the max over the last BW_WINDOW_RTTS min RTTs.
+#define BW_SCALE 24
+#define BW_UNIT (1 << BW_SCALE)
+
+static const u32 BW_WINDOW_RTTS = 10;
+
+// With ECN the fraction of CE marked packets per round is averaged with
+// weight 1/2^ECN_SHIFT, as DCTCP's alpha is.
+#define ECN_SHIFT 4
+
+
+struct davis_params {
+    u32 min_gain_cwnd;
+    u32 reactivity;
+    u32 sensitivity;
+
+    u32 stable_rtts_min;
+    u32 stable_rtts_max;
+
+    u32 rtt_timeout_ms;
+
+    // Pacing rates relative to BDP/min_rtt. Slow start must allow cwnd
+    // to grow by 3/2 per step, drain sends below the bottleneck rate to
+    // empty the queue, and gains probe a little above it.
+    u32 pacing_gain_slow_start;
+    u32 pacing_gain_drain;
+    u32 pacing_gain_stable;
+    u32 pacing_gain_probe;
+
+    // Back off in proportion to CE marks. The kernel module also needs
+    // this to negotiate ECN.
+    u32 ecn;
+
+    // How to find the BDP at the start of a connection, an enum
+    // davis_startup.
+    u32 startup;
+};
+
+#define DAVIS_PARAMS_INIT {                     \
+        .min_gain_cwnd = 4,                     \
+        .reactivity = DAVIS_ONE/8,              \
+        .sensitivity = DAVIS_ONE/64,            \
+        .stable_rtts_min = 3,                   \
+        .stable_rtts_max = 6,                   \
+        .rtt_timeout_ms = 10*MSEC_PER_SEC,      \
+        .pacing_gain_slow_start = 2*DAVIS_ONE,  \
+        .pacing_gain_drain = 3*DAVIS_ONE/4,     \
+        .pacing_gain_stable = DAVIS_ONE,        \
+        .pacing_gain_probe = 5*DAVIS_ONE/4,     \
+        .ecn = 0,                               \
+        .startup = DAVIS_STARTUP_CLASSIC,       \
+    }
+
+
+// Classic startup grows cwnd by 3/2 every three round trips using the
+// GAIN modes, and drains to MIN_CWND once the BDP stops growing. Fast
+// startup doubles cwnd every round trip in DAVIS_STARTUP, and drains
+// to the BDP.
+enum davis_startup { DAVIS_STARTUP_CLASSIC, DAVIS_STARTUP_FAST };
+
+enum davis_mode {
+    DAVIS_DRAIN, DAVIS_STABLE, DAVIS_GAIN_1, DAVIS_GAIN_2, DAVIS_STARTUP
+};
+
+struct davis {
+#ifdef __KERNEL__
+    // Snapshot of the socket's netns parameters taken at init, so the
+    // ACK path never reads tunables that can change under it.
+    const struct davis_params *params;
+#endif
+
+    u8 mode;                    // enum davis_mode
+    bool app_limited;           // Seen during the current gain
+#if defined(__KERNEL__) || defined(__bpf__)
+    bool ece;                   // Set by in_ack_event for cong_control
+#endif
+    u8 stable_rtts;             // Rounds without growth in DAVIS_STARTUP
+
+    // Times are the low 32 bits of the time in microseconds, which
+    // wrap every 71 minutes, so only compare them with davis_elapsed().
+    u32 trans_time;
+    u32 loss_time;              // Start of the last loss episode
+
+    u32 bdp;                    // max_bw*min_rtt, updated every ACK
+    u32 last_bdp;               // bdp at the end of the last gain
+    u32 gain_cwnd;
+
+    u32 last_rtt;
+
+    // Max delivery rate before the last loss backed it off, for undo.
+    // 0 when there is nothing to undo.
+    u32 undo_bw;
+
+    // Min RTT since the last drain, see davis_min_rtt_expired().
+    struct davis_minmax min_rtt_filter;
+
+    // Running max of the delivery rate, in BW_UNIT packets per us.
+    struct davis_minmax bw_filter;
+
+    // CE marks over the current round, and their smoothed fraction
+    // scaled by DAVIS_ONE. ce_frac stays 0 without ECN.
+    u32 round_start;
+    u32 round_delivered;
+    u32 round_ce;
+    u32 ce_frac;
+
+#if !defined(__KERNEL__) && !defined(__bpf__)
+    u32 rand_state;
+#endif
+};
+
+// Davis state as reported to netlink scrapers that ask inet_diag for
+// INET_DIAG_INFO alone. The kernel has no attribute for Davis, so it
+// goes under a private attribute number past anything inet_diag
+// defines; tools that don't know it skip it. Must fit in union
+// tcp_cc_info. ss, which also asks for INET_DIAG_VEGASINFO, gets a
+// struct tcpvegas_info instead, see tcp_davis_get_info().
+#define INET_DIAG_DAVISINFO 0x3f00
+
+struct tcp_davis_info {
+    u32 davis_mode;             // enum davis_mode
+    u32 davis_bdp;              // Packets
+    u32 davis_gain_cwnd;        // Packets
+    u32 davis_min_rtt;          // Microseconds, U32_MAX if unknown
+    u32 davis_stable_rtts;
+};
+
+// What the state machine needs to know about the connection on each
+// ACK.
+struct davis_ack {
+    u64 now;
+    u32 rtt;                    // 0 if there is no RTT sample
+    // Delivery rate sample, as in struct rate_sample. delivered is 0
+    // if there is no sample.
+    u32 delivered;              // Packets delivered over the interval
+    u32 interval;               // Microseconds
+
+    // The application didn't have enough data to fill cwnd when the
+    // sample's packet was sent, or hasn't since.
+    bool app_limited;
+
+    u32 acked;                  // Packets newly delivered by this ACK
+    u32 ce;                     // How many of those were CE marked
+};
+
+
+// Returns NULL if params are usable, or a description of the problem.
+static inline const char* davis_params_check(const struct davis_params *params)
+{
+    if (params->reactivity <= params->sensitivity)
+        return "reactivity must be greater than sensitivity";
+    else if (params->stable_rtts_min > params->stable_rtts_max)
+        return "stable_rtts_min must not be greater than stable_rtts_max";
+    else if (params->stable_rtts_max > U8_MAX)
+        return "stable_rtts_max must be under 256";
+    else if (params->rtt_timeout_ms == 0)
+        return "rtt_timeout_ms must be non-zero";
+    else if (params->rtt_timeout_ms > U32_MAX/4/USEC_PER_MSEC)
+        return "rtt_timeout_ms is too long for the min RTT filter";
+    else if (params->startup > DAVIS_STARTUP_FAST)
+        return "startup must be 0 (classic) or 1 (fast)";
+    else if (params->pacing_gain_slow_start == 0 || params->pacing_gain_drain == 0
+             || params->pacing_gain_stable == 0 || params->pacing_gain_probe == 0)
+        return "pacing gains must be non-zero";
+    else
+        return NULL;
+}
+
+
+static inline u32 davis_elapsed(u64 now, u32 since)
+{
+    return (u32) now - since;
+}
+
+
+static inline u32 davis_min_rtt(const struct davis *davis)
+{
+    return davis_minmax_get(&davis->min_rtt_filter);
+}
+
+
+// Only a sample that matches or beats the min RTT refreshes it, so once
+// rtt_timeout_ms goes by without one, there is probably a standing queue
+// hiding the real min RTT, and a drain should find it. The filter's
+// window is twice the timeout, so the min never ages out and lets
+// queued samples take its place before the drain that replaces it.
+static inline u32 davis_min_rtt_window(const struct davis_params *params)
+{
+    return 2*params->rtt_timeout_ms*USEC_PER_MSEC;
+}
+
+
+static inline bool davis_min_rtt_expired(const struct davis *davis,
+                                         const struct davis_params *params,
+                                         u64 now)
+{
+    return davis_elapsed(now, davis->min_rtt_filter.s[0].t)
+        > params->rtt_timeout_ms*USEC_PER_MSEC;
+}
+
+
+static inline u32 davis_rand(struct davis *davis, u32 ceil)
+{
+#ifdef __KERNEL__
+    return prandom_u32_max(ceil);
+#elif defined(__bpf__)
+    return ((u64) bpf_get_prandom_u32()*ceil) >> 32;
+#else
+    // xorshift32, scaled to [0, ceil) as prandom_u32_max does.
+    u32 x = davis->rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    davis->rand_state = x;
+
+    return ((u64) x*ceil) >> 32;
+#endif
+}
+
+
+static inline bool davis_in_slow_start(u32 snd_cwnd, u32 snd_ssthresh)
+{
+    return snd_cwnd < snd_ssthresh;
+}
+
+
+static inline void davis_set_mode(struct davis *davis, enum davis_mode mode,
+                                  u64 now)
+{
+    davis_trace_mode(davis, mode);
+
+    davis->mode = mode;
+    davis->trans_time = now;
+
+    // Every gain starts with a clean slate, and by then any loss is
+    // too old to be undone.
+    if (mode == DAVIS_GAIN_1) {
+        davis->app_limited = false;
+        davis->undo_bw = 0;
+    }
+}
+
+
+static inline void davis_reset_min_rtt(struct davis *davis, u64 now, u32 rtt)
+{
+    davis_minmax_reset(&davis->min_rtt_filter, now, rtt);
+}
+
+
+static inline u32 davis_bw_to_bdp(u32 bw, u32 min_rtt)
+{
+    return DIV_ROUND_UP_ULL((u64) bw*min_rtt, BW_UNIT);
+}
+
+
+// Replaces the max delivery rate, as after a loss or an undo.
+static inline void davis_set_bw(struct davis *davis, u64 now, u32 bw)
+{
+    u32 min_rtt = davis_min_rtt(davis);
+
+    davis_minmax_reset(&davis->bw_filter, now, bw);
+
+    if (min_rtt != RTT_INF) {
+        davis->bdp = davis_bw_to_bdp(bw, min_rtt);
+        davis_trace_bdp(davis, 0, 0);
+    }
+}
+
+
+static inline void davis_update_gain_cwnd(struct davis *davis,
+                                          const struct davis_params *params)
+{
+    // Gain cwnd = REACTIVITY  * BDP    given unlimited growth
+    // Gain cwnd = SENSITIVITY * BDP    when stable
+    // See Lucas sequence.
+    //
+    // Essentially, start by solving the long term behavior of
+    // snd_cwnd[0] = w
+    // snd_cwnd[1] = w
+    // snd_cwnd[n] = (1 + alpha)*snd_cwnd[n-1] + beta*snd_cwnd[n-2]
+    //
+    // You will get something like
+    // snd_cwnd[n] = C*x^n + D*y^n
+    //
+    // It is the case that C*x^n + D*y^n = O(max(x,y)^n)
+    // So, we can find alpha and beta by solving
+    // max(x, y) = REACTIVITY
+    // (1 + SENSITIVITY)*snd_cwnd = (1 + alpha)*snd_cwnd + beta*snd_cwnd
+    //
+    // Hope this helps any unfortunate readers (possibly future me)
+    // who are trying to puzzle this out. :)
+
+    u32 sensitivity = params->sensitivity;
+    u32 reactivity = max_t(u32, params->reactivity, sensitivity + 1);
+    s64 gain;
+    s64 alpha, beta;
+
+    alpha = DAVIS_ONE + reactivity - sensitivity*DAVIS_ONE/reactivity;
+    beta = sensitivity - alpha;
+
+    gain = alpha*davis->bdp + beta*davis->last_bdp;
+    gain = max_t(s64, gain, (s64) sensitivity*davis->bdp);
+
+    // CE marks mean the probe is already building a queue, so probe
+    // less, but never below the floor.
+    gain = ((u64) gain*(DAVIS_ONE - davis->ce_frac)) >> DAVIS_SHIFT;
+    gain = max_t(s64, gain, (s64) params->min_gain_cwnd*DAVIS_ONE);
+
+    davis->gain_cwnd = (u64) gain >> DAVIS_SHIFT;
+
+    davis_trace_gain_cwnd(davis);
+}
+
+
+static inline void davis_core_init(struct davis *davis,
+                                   const struct davis_params *params,
+                                   const struct davis_ack *ack,
+                                   u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    davis->mode = params->startup == DAVIS_STARTUP_FAST ? DAVIS_STARTUP : DAVIS_GAIN_1;
+    davis->app_limited = false;
+    davis->trans_time = ack->now;
+
+    *snd_cwnd = MIN_CWND;
+    *snd_ssthresh = TCP_INFINITE_SSTHRESH;
+
+    davis->bdp = MIN_CWND;
+    davis->last_bdp = 0;
+    davis_minmax_reset(&davis->bw_filter, ack->now, 0);
+    davis->gain_cwnd = params->min_gain_cwnd;
+
+    davis->stable_rtts = davis->mode == DAVIS_STARTUP ? 0 : params->stable_rtts_min;
+
+    davis->last_rtt = 0;
+    davis->undo_bw = 0;
+    davis_reset_min_rtt(davis, ack->now, RTT_INF);
+
+    // Long enough ago not to count as the round before the first loss.
+    davis->loss_time = (u32) ack->now - U32_MAX/2;
+
+    davis->round_start = ack->now;
+    davis->round_delivered = 0;
+    davis->round_ce = 0;
+    davis->ce_frac = 0;
+}
+
+
+// cwnd outside of gains. Like DCTCP this backs off by half the CE
+// fraction, which drains the standing queue at the marking threshold.
+static inline u32 davis_stable_cwnd(const struct davis *davis)
+{
+    return davis->bdp - (((u64) davis->bdp*davis->ce_frac) >> (DAVIS_SHIFT + 1));
+}
+
+
+// Folds the ACK's CE marks into ce_frac once per round.
+static inline void davis_update_ce_frac(struct davis *davis,
+                                        const struct davis_params *params,
+                                        const struct davis_ack *ack)
+{
+    u32 frac = 0;
+
+    if (!params->ecn)
+        return;
+
+    davis->round_delivered += ack->acked;
+    davis->round_ce += ack->ce;
+
+    if (davis_elapsed(ack->now, davis->round_start) < davis->last_rtt)
+        return;
+
+    if (davis->round_delivered > 0)
+        frac = div_u64((u64) davis->round_ce*DAVIS_ONE, davis->round_delivered);
+
+    davis->ce_frac += (s32) (frac - davis->ce_frac) >> ECN_SHIFT;
+
+    davis->round_start = ack->now;
+    davis->round_delivered = 0;
+    davis->round_ce = 0;
+}
+
+
+// Feeds the ACK's delivery rate sample into the max filter and updates
+// the BDP from it. App-limited samples only count if they raise the
+// max, since otherwise they just show the application was idle.
+static inline void davis_update_bdp(struct davis *davis,
+                                    const struct davis_ack *ack)
+{
+    u32 min_rtt = davis_min_rtt(davis);
+    u64 bw;
+    u32 bdp;
+
+    if (ack->delivered == 0 || ack->interval == 0 || min_rtt == RTT_INF)
+        return;
+
+    bw = div_u64((u64) ack->delivered << BW_SCALE, ack->interval);
+    bw = min_t(u64, bw, U32_MAX);
+
+    if (ack->app_limited && bw < davis_minmax_get(&davis->bw_filter))
+        return;
+
+    // For a round trip after a congestive loss, samples still come from
+    // the window that overflowed, and would just undo the back off.
+    if (davis->undo_bw != 0 && davis->mode == DAVIS_STABLE
+        && davis_elapsed(ack->now, davis->trans_time) < davis->last_rtt)
+        return;
+
+    davis_minmax_running_max(&davis->bw_filter, BW_WINDOW_RTTS*min_rtt,
+                             ack->now, bw);
+
+    bdp = davis_bw_to_bdp(davis_minmax_get(&davis->bw_filter), min_rtt);
+
+    if (bdp != davis->bdp) {
+        davis->bdp = bdp;
+        davis_trace_bdp(davis, ack->delivered, ack->interval);
+    }
+}
+
+
+static inline bool davis_slow_start(struct davis *davis,
+                                    const struct davis_ack *ack,
+                                    u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    u64 now = ack->now;
+
+    if (davis->mode == DAVIS_GAIN_1) {
+        if (davis_elapsed(now, davis->trans_time) > GAIN_1_RTTS*davis->last_rtt) {
+            davis_set_mode(davis, DAVIS_GAIN_2, now);
+        }
+    } else if (davis->mode == DAVIS_GAIN_2) {
+        if (davis_elapsed(now, davis->trans_time) > GAIN_2_RTTS*davis->last_rtt) {
+            // If the application didn't fill the window, the BDP not
+            // growing says nothing about the path. Try again.
+            if (davis->app_limited && davis->bdp <= davis->last_bdp) {
+                davis_set_mode(davis, DAVIS_GAIN_1, now);
+                return false;
+            }
+
+            if (davis->bdp > davis->last_bdp) {
+                davis_set_mode(davis, DAVIS_GAIN_1, now);
+
+                *snd_cwnd = 3*davis->bdp/2;
+
+                davis->last_bdp = davis->bdp;
+            } else {
+                davis_set_mode(davis, DAVIS_DRAIN, now);
+
+                *snd_cwnd = MIN_CWND;
+                *snd_ssthresh = MIN_CWND;
+            }
+
+            return true;
+        }
+    } else {
+        // The stack only puts ssthresh back above cwnd when it undoes a
+        // loss in slow start, so pick up where that left off.
+        davis_set_mode(davis, DAVIS_GAIN_1, now);
+
+        *snd_cwnd = max_t(u32, *snd_cwnd, davis->bdp);
+    }
+
+    return false;
+}
+
+
+static inline void davis_exit_startup(struct davis *davis,
+                                      const struct davis_params *params,
+                                      u64 now, u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    davis_set_mode(davis, DAVIS_DRAIN, now);
+
+    davis->last_bdp = davis->bdp;
+    davis->stable_rtts = params->stable_rtts_min;
+
+    // Capping cwnd at the BDP drains whatever queue startup built.
+    *snd_cwnd = davis->bdp;
+    *snd_ssthresh = MIN_CWND;
+}
+
+
+// Fast startup. Each ACK grows cwnd by what it delivered, doubling it
+// every round trip, and the slow start pacing gain keeps the rate in
+// step. Rounds where the application didn't fill cwnd don't count
+// towards finding the pipe full.
+static inline bool davis_fast_startup(struct davis *davis,
+                                      const struct davis_params *params,
+                                      const struct davis_ack *ack,
+                                      u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    u64 now = ack->now;
+    bool grew;
+
+    // Back in slow start after an undo, see davis_slow_start().
+    if (davis->mode != DAVIS_STARTUP) {
+        davis_set_mode(davis, DAVIS_STARTUP, now);
+        davis->stable_rtts = 0;
+
+        *snd_cwnd = max_t(u32, *snd_cwnd, davis->bdp);
+        return false;
+    }
+
+    // Without more than that in flight, the next round's rate samples
+    // can't show any more bandwidth.
+    *snd_cwnd = min_t(u32, *snd_cwnd + ack->acked, 2*davis->bdp);
+
+    if (davis_elapsed(now, davis->trans_time) <= davis->last_rtt)
+        return false;
+
+    grew = (u64) davis->bdp*DAVIS_ONE >= (u64) davis->last_bdp*STARTUP_GROWTH;
+
+    if (grew) {
+        davis->last_bdp = davis->bdp;
+        davis->stable_rtts = 0;
+    } else if (!davis->app_limited && ++davis->stable_rtts >= STARTUP_FULL_ROUNDS) {
+        davis_exit_startup(davis, params, now, snd_cwnd, snd_ssthresh);
+        return true;
+    }
+
+    davis->trans_time = now;
+    davis->app_limited = false;
+
+    return grew;
+}
+
+
+// Advance the state machine on an ACK. Returns true at the end of each
+// gain, when the BDP is taken as the base for the next cycle.
+static inline bool davis_core_on_ack(struct davis *davis,
+                                     const struct davis_params *params,
+                                     const struct davis_ack *ack,
+                                     u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    u64 now = ack->now;
+    bool new_bdp = false;
+
+    if (ack->rtt > 0) {
+        davis_minmax_running_min(&davis->min_rtt_filter,
+                                 davis_min_rtt_window(params), now, ack->rtt);
+        davis->last_rtt = ack->rtt;
+    }
+
+    davis_update_bdp(davis, ack);
+    davis_update_ce_frac(davis, params, ack);
+
+    if (ack->app_limited
+        && (davis->mode == DAVIS_GAIN_1 || davis->mode == DAVIS_GAIN_2
+            || davis->mode == DAVIS_STARTUP))
+        davis->app_limited = true;
+
+
+    if (davis_in_slow_start(*snd_cwnd, *snd_ssthresh)) {
+        if (params->startup == DAVIS_STARTUP_FAST)
+            new_bdp = davis_fast_startup(davis, params, ack, snd_cwnd, snd_ssthresh);
+        else
+            new_bdp = davis_slow_start(davis, ack, snd_cwnd, snd_ssthresh);
+    } else if (davis->mode == DAVIS_DRAIN) {
+        if (davis_elapsed(now, davis->trans_time) > DRAIN_RTTS*davis->last_rtt) {
+            davis_set_mode(davis, DAVIS_STABLE, now);
+
+            *snd_cwnd = davis_stable_cwnd(davis);
+        }
+    } else if (davis->mode == DAVIS_STABLE) {
+        if (davis_elapsed(now, davis->trans_time) > davis->stable_rtts*davis->last_rtt) {
+            davis_set_mode(davis, DAVIS_GAIN_1, now);
+
+            *snd_cwnd = davis_stable_cwnd(davis) + davis->gain_cwnd;
+        } else {
+            // Follow the BDP, which also restores cwnd after the stack
+            // cuts it on restarting from idle.
+            *snd_cwnd = davis_stable_cwnd(davis);
+        }
+    } else if (davis->mode == DAVIS_GAIN_1) {
+        if (davis_elapsed(now, davis->trans_time) > GAIN_1_RTTS*davis->last_rtt) {
+            davis_set_mode(davis, DAVIS_GAIN_2, now);
+        }
+    } else if (davis->mode == DAVIS_GAIN_2) {
+        if (davis_elapsed(now, davis->trans_time) > GAIN_2_RTTS*davis->last_rtt) {
+            // An app-limited gain that didn't find more bandwidth keeps
+            // the last cycle's BDP and gain, rather than learning from
+            // a window the application didn't fill.
+            if (!davis->app_limited || davis->bdp > davis->last_bdp) {
+                davis_update_gain_cwnd(davis, params);
+                davis->last_bdp = davis->bdp;
+                new_bdp = true;
+            }
+
+            if (davis_min_rtt_expired(davis, params, now)) {
+                davis_set_mode(davis, DAVIS_DRAIN, now);
+
+                *snd_cwnd = MIN_CWND;
+                davis_reset_min_rtt(davis, now, davis->last_rtt);
+            } else {
+                u32 rtt_diff = params->stable_rtts_max - params->stable_rtts_min;
+
+                davis_set_mode(davis, DAVIS_STABLE, now);
+
+                davis->stable_rtts = params->stable_rtts_min;
+                davis->stable_rtts += davis_rand(davis, rtt_diff + 1);
+
+                *snd_cwnd = davis_stable_cwnd(davis);
+            }
+        }
+    } else {
+        davis_err("Got to undefined mode %d at time %llu\n",
+                  davis->mode, (unsigned long long) now);
+
+        davis_set_mode(davis, DAVIS_DRAIN, now);
+
+        *snd_cwnd = MIN_CWND;
+    }
+
+    *snd_cwnd = clamp_t(u32, *snd_cwnd, MIN_CWND, MAX_CWND);
+
+    return new_bdp;
+}
+
+
+static inline u32 davis_pacing_gain(const struct davis *davis,
+                                    const struct davis_params *params,
+                                    u32 snd_cwnd, u32 snd_ssthresh)
+{
+    if (davis_in_slow_start(snd_cwnd, snd_ssthresh))
+        return params->pacing_gain_slow_start;
+    else if (davis->mode == DAVIS_DRAIN)
+        return params->pacing_gain_drain;
+    else if (davis->mode == DAVIS_STABLE)
+        return params->pacing_gain_stable;
+    else
+        return params->pacing_gain_probe;
+}
+
+
+// Pacing rate in bytes per second for the current mode, or 0 before
+// there is an RTT estimate to base it on.
+static inline u64 davis_pacing_rate(const struct davis *davis,
+                                    const struct davis_params *params,
+                                    u32 snd_cwnd, u32 snd_ssthresh, u32 mss)
+{
+    u32 gain = davis_pacing_gain(davis, params, snd_cwnd, snd_ssthresh);
+    u32 min_rtt = davis_min_rtt(davis);
+    u64 rate;
+
+    if (min_rtt == RTT_INF || min_rtt == 0)
+        return 0;
+
+    rate = div_u64((u64) davis->bdp*mss*USEC_PER_SEC, min_rtt);
+
+    return (rate*gain) >> DAVIS_SHIFT;
+}
+
+
+// A loss is congestive if it came with a queue. A buffer too shallow to
+// show a queue still overflows every round and cuts the delivery rate,
+// so a loss also counts if the last episode was a round trip before
+// and the newest rate sample in bw_filter is well below its max.
+// Random loss neither repeats that often at moderate rates nor slows
+// delivery.
+static inline bool davis_congestive_loss(struct davis *davis, u64 now)
+{
+    u32 min_rtt = davis_min_rtt(davis);
+    bool repeated = davis_elapsed(now, davis->loss_time) <= 2*davis->last_rtt;
+
+    davis->loss_time = now;
+
+    if (min_rtt == RTT_INF)
+        return false;
+
+    return (repeated && (u64) davis->bw_filter.s[2].v*DAVIS_ONE
+            < (u64) davis->bw_filter.s[0].v*(DAVIS_ONE - MIN_RTT_SLACK))
+        || (u64) davis->last_rtt*DAVIS_ONE > (u64) min_rtt*(DAVIS_ONE + MIN_RTT_SLACK);
+}
+
+
+// Call once per loss episode, as tcp_davis_set_state() does. Random loss
+// is left alone, since cutting cwnd for it would only leave the link
+// idle. Congestive loss in slow start means startup overshot, so drain
+// and settle on the current BDP. After that it backs the BDP off and
+// ends any gain in progress.
+static inline void davis_core_on_loss(struct davis *davis,
+                                      const struct davis_params *params,
+                                      u64 now, u32 *snd_cwnd, u32 *snd_ssthresh)
+{
+    u32 max_bw = davis_minmax_get(&davis->bw_filter);
+
+    if (!davis_congestive_loss(davis, now))
+        return;
+
+    if (davis_in_slow_start(*snd_cwnd, *snd_ssthresh)) {
+        if (params->startup == DAVIS_STARTUP_FAST) {
+            davis_exit_startup(davis, params, now, snd_cwnd, snd_ssthresh);
+        } else {
+            davis_set_mode(davis, DAVIS_DRAIN, now);
+
+            *snd_cwnd = MIN_CWND;
+            *snd_ssthresh = MIN_CWND;
+        }
+        return;
+    }
+
+    // Several losses before an undo all go back to the first's rate.
+    if (davis->undo_bw == 0)
+        davis->undo_bw = max_t(u32, max_bw, 1);
+
+    davis_set_bw(davis, now, ((u64) max_bw*LOSS_BETA) >> DAVIS_SHIFT);
+    davis->last_bdp = min_t(u32, davis->last_bdp, davis->bdp);
+
+    // A drain is already emptying the queue. Otherwise start a fresh
+    // stable period, which also holds off rate samples from the window
+    // that overflowed, see davis_update_bdp().
+    if (davis->mode != DAVIS_DRAIN) {
+        davis_set_mode(davis, DAVIS_STABLE, now);
+
+        *snd_cwnd = clamp_t(u32, davis_stable_cwnd(davis), MIN_CWND, MAX_CWND);
+    }
+}
+
+
+// The last losses were spurious, so take back what davis_core_on_loss()
+// did. If they were in slow start, the stack restores the infinite
+// ssthresh instead, and the next ACK resumes it.
+static inline void davis_core_undo(struct davis *davis, u64 now,
+                                   u32 *snd_cwnd)
+{
+    if (davis->undo_bw == 0)
+        return;
+
+    if (davis->undo_bw > davis_minmax_get(&davis->bw_filter))
+        davis_set_bw(davis, now, davis->undo_bw);
+
+    davis->undo_bw = 0;
+
+    if (davis->mode == DAVIS_STABLE)
+        *snd_cwnd = clamp_t(u32, davis_stable_cwnd(davis), MIN_CWND, MAX_CWND);
+}
+
+
+#endif /* _DAVIS_CORE_H_ */
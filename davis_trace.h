@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Davis congestion control tracepoints
+ *
+ * These show up as tcp_davis:* in perf, trace-cmd and bpftrace, and
+ * cost a static branch when disabled. Modes are numbered as in enum
+ * davis_mode, which isn't visible here since this is included before
+ * davis_core.h.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tcp_davis
+
+#if !defined(_DAVIS_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _DAVIS_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <net/inet_sock.h>
+
+#define davis_mode_names                        \
+    { 0, "DRAIN" },                             \
+    { 1, "STABLE" },                            \
+    { 2, "GAIN_1" },                            \
+    { 3, "GAIN_2" },                            \
+    { 4, "STARTUP" }
+
+
+TRACE_EVENT(davis_mode,
+
+    TP_PROTO(const struct sock *sk, u32 old_mode, u32 new_mode,
+             u32 bdp, u32 min_rtt),
+
+    TP_ARGS(sk, old_mode, new_mode, bdp, min_rtt),
+
+    TP_STRUCT__entry(
+        __field(const void *, skaddr)
+        __field(__u16, sport)
+        __field(__u16, dport)
+        __field(u32, old_mode)
+        __field(u32, new_mode)
+        __field(u32, bdp)
+        __field(u32, min_rtt)
+    ),
+
+    TP_fast_assign(
+        __entry->skaddr = sk;
+        __entry->sport = ntohs(inet_sk(sk)->inet_sport);
+        __entry->dport = ntohs(inet_sk(sk)->inet_dport);
+        __entry->old_mode = old_mode;
+        __entry->new_mode = new_mode;
+        __entry->bdp = bdp;
+        __entry->min_rtt = min_rtt;
+    ),
+
+    TP_printk("skaddr=%p sport=%hu dport=%hu %s -> %s bdp=%u min_rtt=%u",
+              __entry->skaddr, __entry->sport, __entry->dport,
+              __print_symbolic(__entry->old_mode, davis_mode_names),
+              __print_symbolic(__entry->new_mode, davis_mode_names),
+              __entry->bdp, __entry->min_rtt)
+);
+
+
+TRACE_EVENT(davis_bdp,
+
+    TP_PROTO(const struct sock *sk, u32 diff_deliv, u32 interval,
+             u32 min_rtt, u32 bdp),
+
+    TP_ARGS(sk, diff_deliv, interval, min_rtt, bdp),
+
+    TP_STRUCT__entry(
+        __field(const void *, skaddr)
+        __field(__u16, sport)
+        __field(__u16, dport)
+        __field(u32, diff_deliv)
+        __field(u32, interval)
+        __field(u32, min_rtt)
+        __field(u32, bdp)
+    ),
+
+    TP_fast_assign(
+        __entry->skaddr = sk;
+        __entry->sport = ntohs(inet_sk(sk)->inet_sport);
+        __entry->dport = ntohs(inet_sk(sk)->inet_dport);
+        __entry->diff_deliv = diff_deliv;
+        __entry->interval = interval;
+        __entry->min_rtt = min_rtt;
+        __entry->bdp = bdp;
+    ),
+
+    TP_printk("skaddr=%p sport=%hu dport=%hu diff_deliv=%u interval=%u min_rtt=%u bdp=%u",
+              __entry->skaddr, __entry->sport, __entry->dport,
+              __entry->diff_deliv, __entry->interval, __entry->min_rtt,
+              __entry->bdp)
+);
+
+
+TRACE_EVENT(davis_gain_cwnd,
+
+    TP_PROTO(const struct sock *sk, u32 bdp, u32 last_bdp, u32 gain_cwnd),
+
+    TP_ARGS(sk, bdp, last_bdp, gain_cwnd),
+
+    TP_STRUCT__entry(
+        __field(const void *, skaddr)
+        __field(__u16, sport)
+        __field(__u16, dport)
+        __field(u32, bdp)
+        __field(u32, last_bdp)
+        __field(u32, gain_cwnd)
+    ),
+
+    TP_fast_assign(
+        __entry->skaddr = sk;
+        __entry->sport = ntohs(inet_sk(sk)->inet_sport);
+        __entry->dport = ntohs(inet_sk(sk)->inet_dport);
+        __entry->bdp = bdp;
+        __entry->last_bdp = last_bdp;
+        __entry->gain_cwnd = gain_cwnd;
+    ),
+
+    TP_printk("skaddr=%p sport=%hu dport=%hu bdp=%u last_bdp=%u gain_cwnd=%u",
+              __entry->skaddr, __entry->sport, __entry->dport,
+              __entry->bdp, __entry->last_bdp, __entry->gain_cwnd)
+);
+
+#endif /* _DAVIS_TRACE_H_ */
+
+
+// This header lives next to the module, not in include/trace/events.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE davis_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,355 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capacity.h"
+
+
+#define MAX_COLUMNS 3
+
+
+static const char* line_end(const struct capacity_trace *trace, const char *pos)
+{
+    const char *eol = memchr(pos, '\n', trace->data + trace->size - pos);
+
+    return eol != NULL ? eol : trace->data + trace->size;
+}
+
+
+static const char* next_line(const struct capacity_trace *trace, const char *pos)
+{
+    const char *eol = line_end(trace, pos);
+
+    return eol < trace->data + trace->size ? eol + 1 : eol;
+}
+
+
+// Parses the comma separated numbers on a line into values. Returns
+// how many there were, 0 for a blank or comment line, and -1 for
+// anything else, such as a header. The mapping isn't NUL terminated,
+// so each field is copied out before strtod() sees it.
+static int parse_line(const char *pos, const char *eol, double *values)
+{
+    int n = 0;
+
+    while (pos < eol && isspace((unsigned char) *pos))
+        pos++;
+
+    if (pos == eol || *pos == '#')
+        return 0;
+
+    for (;;) {
+        const char *comma = memchr(pos, ',', eol - pos);
+        const char *field_end = comma != NULL ? comma : eol;
+        char field[64];
+        char *end;
+
+        if (n == MAX_COLUMNS || field_end - pos >= (long) sizeof(field))
+            return -1;
+
+        memcpy(field, pos, field_end - pos);
+        field[field_end - pos] = '\0';
+        values[n] = strtod(field, &end);
+
+        while (isspace((unsigned char) *end))
+            end++;
+
+        if (end == field || *end != '\0' || !isfinite(values[n]))
+            return -1;
+
+        n++;
+
+        if (comma == NULL)
+            return n;
+
+        pos = comma + 1;
+    }
+}
+
+
+// Reads the next row from pos on, skipping blank lines and the header.
+// Returns how many values it had, or 0 at the end of the trace.
+static int read_row(const struct capacity_trace *trace, const char **pos,
+                    double *values)
+{
+    while (*pos < trace->data + trace->size) {
+        const char *eol = line_end(trace, *pos);
+        int n = parse_line(*pos, eol, values);
+
+        *pos = eol < trace->data + trace->size ? eol + 1 : eol;
+
+        if (n > 0)
+            return n;
+    }
+
+    return 0;
+}
+
+
+// Checks every row and works out the trace's format and summary.
+static bool capacity_trace_check(struct capacity_trace *trace,
+                                 const char *path)
+{
+    const char *pos = trace->data;
+    const char *end = trace->data + trace->size;
+    double last_time = 0, last_rate = 0, bytes = 0;
+    size_t lineno = 0, rows = 0;
+    int columns = 0;
+    bool header = false;
+
+    trace->min_delay = INFINITY;
+
+    for (; pos < end; pos = next_line(trace, pos)) {
+        double values[MAX_COLUMNS] = {0};
+        int n = parse_line(pos, line_end(trace, pos), values);
+
+        lineno++;
+
+        if (n == 0)
+            continue;
+
+        // Only the first line may be a header.
+        if (n < 0 && rows == 0 && !header) {
+            header = true;
+            continue;
+        }
+
+        if (n < 0 || (rows > 0 && n != columns)) {
+            fprintf(stderr, "%s:%zu: bad row\n", path, lineno);
+            return false;
+        }
+
+        if (rows == 0)
+            trace->format = n == 1 ? CAPACITY_MAHIMAHI : CAPACITY_CSV;
+
+        columns = n;
+
+        if (values[0] < last_time || values[0] < 0 || values[1] < 0
+            || values[2] < 0) {
+            fprintf(stderr, "%s:%zu: times must not go back, nor rates or "
+                    "delays be negative\n", path, lineno);
+            return false;
+        }
+
+        if (trace->format == CAPACITY_MAHIMAHI) {
+            bytes += MAHIMAHI_MTU;
+            last_time = values[0];
+        } else {
+            bytes += last_rate*(values[0] - last_time);
+            last_time = values[0];
+            last_rate = values[1];
+            trace->min_delay = fmin(trace->min_delay, values[2]);
+        }
+
+        rows++;
+    }
+
+    if (rows == 0) {
+        fprintf(stderr, "%s: no rows\n", path);
+        return false;
+    }
+
+    if (trace->format == CAPACITY_MAHIMAHI) {
+        trace->period = last_time/1e3;
+        trace->mean_rate = bytes/trace->period;
+        trace->min_delay = 0;
+
+        if (trace->period <= 0) {
+            fprintf(stderr, "%s: the trace must last more than 0ms\n", path);
+            return false;
+        }
+    } else {
+        trace->period = INFINITY;
+        trace->mean_rate = last_time > 0 ? bytes/last_time : last_rate;
+
+        if (trace->mean_rate <= 0) {
+            fprintf(stderr, "%s: the link never sends anything\n", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+struct capacity_trace* capacity_trace_open(const char *path)
+{
+    struct capacity_trace *trace;
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: no rows\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    // Every run reads it front to back.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    trace = calloc(1, sizeof(struct capacity_trace));
+
+    if (trace == NULL) {
+        fprintf(stderr, "Could not allocate the capacity trace for %s\n", path);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    trace->data = data;
+    trace->size = st.st_size;
+    trace->refs = 1;
+
+    if (!capacity_trace_check(trace, path)) {
+        capacity_trace_put(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+
+struct capacity_trace* capacity_trace_get(struct capacity_trace *trace)
+{
+    if (trace != NULL)
+        trace->refs++;
+
+    return trace;
+}
+
+
+void capacity_trace_put(struct capacity_trace *trace)
+{
+    if (trace == NULL || --trace->refs > 0)
+        return;
+
+    munmap((void*) trace->data, trace->size);
+    free(trace);
+}
+
+
+static void csv_read_end(struct capacity_cursor *cursor)
+{
+    double values[MAX_COLUMNS] = {0};
+
+    if (read_row(cursor->trace, &cursor->next, values) > 0) {
+        cursor->end = values[0];
+        cursor->end_rate = values[1];
+        cursor->end_delay = values[2];
+    } else {
+        cursor->end = INFINITY;
+    }
+}
+
+
+static void csv_seek(struct capacity_cursor *cursor, double time)
+{
+    while (time >= cursor->end) {
+        cursor->time = cursor->end;
+        cursor->rate = cursor->end_rate;
+        cursor->delay = cursor->end_delay;
+        csv_read_end(cursor);
+    }
+}
+
+
+static void mahimahi_advance(struct capacity_cursor *cursor)
+{
+    const struct capacity_trace *trace = cursor->trace;
+    double values[MAX_COLUMNS];
+
+    if (read_row(trace, &cursor->next, values) == 0) {
+        cursor->repeat_start += trace->period;
+        cursor->next = trace->data;
+        read_row(trace, &cursor->next, values);
+    }
+
+    cursor->time = cursor->repeat_start + values[0]/1e3;
+}
+
+
+void capacity_cursor_init(struct capacity_cursor *cursor,
+                          const struct capacity_trace *trace)
+{
+    memset(cursor, 0, sizeof(*cursor));
+
+    cursor->trace = trace;
+    cursor->next = trace->data;
+
+    if (trace->format == CAPACITY_MAHIMAHI) {
+        mahimahi_advance(cursor);
+    } else {
+        // The first row also covers any time before it.
+        csv_read_end(cursor);
+        csv_seek(cursor, cursor->end);
+        cursor->time = 0;
+    }
+}
+
+
+double capacity_send(struct capacity_cursor *cursor, double time,
+                     unsigned long size)
+{
+    double left = size;
+
+    if (cursor->trace->format == CAPACITY_MAHIMAHI) {
+        unsigned long needed = (size + MAHIMAHI_MTU - 1)/MAHIMAHI_MTU;
+        double done = time;
+
+        // Opportunities that came while the link was idle are gone.
+        while (cursor->time < time)
+            mahimahi_advance(cursor);
+
+        for (; needed > 0; needed--) {
+            done = cursor->time;
+            mahimahi_advance(cursor);
+        }
+
+        return done;
+    }
+
+    csv_seek(cursor, time);
+
+    for (;;) {
+        if (cursor->rate > 0 && left <= cursor->rate*(cursor->end - time))
+            return time + left/cursor->rate;
+
+        if (isinf(cursor->end))
+            return INFINITY;
+
+        left -= cursor->rate*(cursor->end - time);
+        time = cursor->end;
+        csv_seek(cursor, time);
+    }
+}
+
+
+double capacity_delay(struct capacity_cursor *cursor, double time)
+{
+    if (cursor->trace->format == CAPACITY_MAHIMAHI)
+        return 0;
+
+    csv_seek(cursor, time);
+
+    return cursor->delay;
+}
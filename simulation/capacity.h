@@ -0,0 +1,70 @@
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifndef _CAPACITY_H_
+#define _CAPACITY_H_
+
+
+// Mahimahi traces list, one per line, the millisecond at which the link
+// can deliver one MAHIMAHI_MTU byte packet, and repeat from the start
+// after the last one. CSV traces have "time,rate[,delay]" rows in
+// seconds and bytes/s, each in force until the next, and the last for
+// the rest of the run. delay adds to the RTT of flows over the link.
+enum capacity_format { CAPACITY_MAHIMAHI, CAPACITY_CSV };
+
+#define MAHIMAHI_MTU 1500
+
+// A recorded link capacity, mapped read only and shared by every
+// scenario copy that refers to it.
+struct capacity_trace {
+    const char *data;
+    size_t size;
+    enum capacity_format format;
+    unsigned int refs;
+
+    double period;              // Of a Mahimahi trace
+    double mean_rate;           // Over the trace, for sizing buffers
+    double min_delay;
+};
+
+// A run's position in a trace. Times given to a cursor must never go
+// back, so it only ever reads forward.
+struct capacity_cursor {
+    const struct capacity_trace *trace;
+    const char *next;           // The next line to read
+    double repeat_start;        // Of a Mahimahi trace's current repetition
+
+    // The current CSV row, in force until end, or the next unused
+    // Mahimahi delivery opportunity.
+    double time;
+    double rate;
+    double delay;
+    double end;
+    double end_rate;
+    double end_delay;
+};
+
+
+// Maps and checks a trace, printing an error and returning NULL if it
+// can't be used.
+struct capacity_trace* capacity_trace_open(const char *path);
+
+struct capacity_trace* capacity_trace_get(struct capacity_trace *trace);
+
+void capacity_trace_put(struct capacity_trace *trace);
+
+
+void capacity_cursor_init(struct capacity_cursor *cursor,
+                          const struct capacity_trace *trace);
+
+// When a packet of size bytes that starts out at time has been sent.
+double capacity_send(struct capacity_cursor *cursor, double time,
+                     unsigned long size);
+
+// The trace's extra delay at time.
+double capacity_delay(struct capacity_cursor *cursor, double time);
+
+
+
+#endif /* _CAPACITY_H_ */
@@ -0,0 +1,665 @@
+#include <math.h>
+#include <string.h>
+
+#include "cc.h"
+
+
+// As Linux's TCP_INIT_CWND and TCP_INFINITE_SSTHRESH.
+#define INIT_CWND 10
+#define SSTHRESH_INF 0x7fffffff
+
+#define CUBIC_BETA 0.7
+#define CUBIC_C 0.4
+
+// HyStart leaves slow start once the RTT of a round's first
+// HYSTART_MIN_SAMPLES ACKs rises an eighth above the minimum, clamped
+// to these bounds. It doesn't act on windows under HYSTART_LOW_WINDOW.
+#define HYSTART_LOW_WINDOW 16
+#define HYSTART_MIN_SAMPLES 8
+#define HYSTART_DELAY_MIN 4e-3
+#define HYSTART_DELAY_MAX 16e-3
+
+#define BBR_HIGH_GAIN 2.885     // 2/ln(2), to double the rate every round
+#define BBR_CWND_GAIN 2.0
+#define BBR_MIN_CWND 4
+#define BBR_MIN_RTT_WIN 10.0
+#define BBR_PROBE_RTT_TIME 0.2
+#define BBR_FULL_BW_THRESH 1.25
+#define BBR_FULL_BW_CNT 3
+#define BBR_PACING_MARGIN 0.99
+
+static const double bbr_pacing_gains[BBR_CYCLE_LEN] = {
+    1.25, 0.75, 1, 1, 1, 1, 1, 1,
+};
+
+
+const char *const cc_names[NUM_CC] = {"davis", "reno", "cubic", "bbr"};
+
+
+bool cc_parse(const char *name, enum cc_algorithm *algorithm)
+{
+    for (int i = 0; i < NUM_CC; i++) {
+        if (strcmp(name, cc_names[i]) == 0) {
+            *algorithm = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*** Davis ***/
+
+static void davis_sync(struct cc *cc)
+{
+    cc->cwnd = cc->davis.cwnd;
+    cc->ssthresh = cc->davis.ssthresh;
+    cc->pacing_rate = cc->davis.pacing_rate;
+}
+
+
+static void davis_cc_init(struct cc *cc, double time, long seed)
+{
+    davis_init(&cc->davis, cc->params, time, cc->mss, cc->pacing, seed);
+    davis_sync(cc);
+}
+
+
+static void davis_cc_on_ack(struct cc *cc, const struct cc_ack *ack)
+{
+    davis_on_ack(&cc->davis, ack->time, ack->rtt, ack->delivered,
+                 ack->interval, ack->app_limited, ack->ce);
+    davis_sync(cc);
+}
+
+
+static void davis_cc_on_loss(struct cc *cc, double time)
+{
+    davis_on_loss(&cc->davis, time);
+    davis_sync(cc);
+}
+
+
+static void davis_cc_trace(const struct cc *cc, struct trace_record *record)
+{
+    const struct davis *core = &cc->davis.core;
+    u32 min_rtt = davis_min_rtt(core);
+
+    record->mode = core->mode;
+    record->gain_cwnd = core->gain_cwnd;
+    record->min_rtt = min_rtt == RTT_INF ? 0 : (double) min_rtt/USEC_PER_SEC;
+    record->bdp = core->bdp;
+}
+
+
+static const struct cc_ops davis_ops = {
+    .init = davis_cc_init,
+    .on_ack = davis_cc_on_ack,
+    .on_loss = davis_cc_on_loss,
+    .trace = davis_cc_trace,
+};
+
+
+/*** Reno ***/
+
+// Like tcp_is_cwnd_limited(): slow start may take cwnd up to twice what
+// is in flight, congestion avoidance only grows a full window.
+static bool cwnd_limited(const struct cc *cc, const struct cc_ack *ack)
+{
+    if (cc->cwnd < cc->ssthresh)
+        return cc->cwnd < 2*ack->inflight;
+    else
+        return ack->inflight >= cc->cwnd;
+}
+
+
+// RFC 3168 treats a CE mark as a loss, at most once per round trip.
+static bool ce_is_loss(const struct cc *cc, const struct cc_ack *ack,
+                       double *cwr_end)
+{
+    if (!ack->ce || ack->time < *cwr_end)
+        return false;
+
+    *cwr_end = ack->time + cc->srtt;
+
+    return true;
+}
+
+
+// Paced at twice cwnd per RTT in slow start and 1.2 times after, as
+// tcp_update_pacing_rate() does for flows that don't pace themselves.
+static void tcp_pacing_rate(struct cc *cc)
+{
+    double ratio = cc->cwnd < cc->ssthresh/2 ? 2 : 1.2;
+
+    if (cc->pacing && cc->srtt > 0)
+        cc->pacing_rate = ratio*cc->cwnd*cc->mss/cc->srtt;
+}
+
+
+// One more packet of cwnd every cnt ACKs, as tcp_cong_avoid_ai().
+static void cong_avoid_ai(struct cc *cc, u32 *cwnd_cnt, double cnt)
+{
+    if (++*cwnd_cnt >= cnt) {
+        *cwnd_cnt = 0;
+        cc->cwnd++;
+    }
+}
+
+
+static void reno_init(struct cc *cc, double time, long seed)
+{
+    (void) time;
+    (void) seed;
+
+    cc->cwnd = INIT_CWND;
+    cc->ssthresh = SSTHRESH_INF;
+}
+
+
+static void reno_on_loss(struct cc *cc, double time)
+{
+    (void) time;
+
+    cc->ssthresh = cc->cwnd/2 > 2 ? cc->cwnd/2 : 2;
+    cc->cwnd = cc->ssthresh;
+    cc->reno.cwnd_cnt = 0;
+
+    tcp_pacing_rate(cc);
+}
+
+
+static void reno_on_ack(struct cc *cc, const struct cc_ack *ack)
+{
+    if (ce_is_loss(cc, ack, &cc->reno.cwr_end)) {
+        reno_on_loss(cc, ack->time);
+        return;
+    }
+
+    if (cwnd_limited(cc, ack)) {
+        if (cc->cwnd < cc->ssthresh)
+            cc->cwnd++;
+        else
+            cong_avoid_ai(cc, &cc->reno.cwnd_cnt, cc->cwnd);
+    }
+
+    tcp_pacing_rate(cc);
+}
+
+
+static const struct cc_ops reno_ops = {
+    .init = reno_init,
+    .on_ack = reno_on_ack,
+    .on_loss = reno_on_loss,
+};
+
+
+/*** CUBIC ***/
+
+static void cubic_init(struct cc *cc, double time, long seed)
+{
+    struct cubic *c = &cc->cubic;
+
+    (void) time;
+    (void) seed;
+
+    cc->cwnd = INIT_CWND;
+    cc->ssthresh = SSTHRESH_INF;
+
+    c->epoch_start = NAN;
+    c->min_rtt = INFINITY;
+    c->round_min_rtt = INFINITY;
+}
+
+
+static void cubic_on_loss(struct cc *cc, double time)
+{
+    struct cubic *c = &cc->cubic;
+    u32 ssthresh = cc->cwnd*CUBIC_BETA;
+
+    (void) time;
+
+    c->epoch_start = NAN;
+
+    // Fast convergence: leave room to a flow that has just arrived.
+    if (cc->cwnd < c->w_max)
+        c->w_max = cc->cwnd*(1 + CUBIC_BETA)/2;
+    else
+        c->w_max = cc->cwnd;
+
+    cc->ssthresh = ssthresh > 2 ? ssthresh : 2;
+    cc->cwnd = cc->ssthresh;
+    c->cwnd_cnt = 0;
+
+    tcp_pacing_rate(cc);
+}
+
+
+static void cubic_hystart(struct cc *cc, const struct cc_ack *ack)
+{
+    struct cubic *c = &cc->cubic;
+    double thresh = fmin(fmax(c->min_rtt/8, HYSTART_DELAY_MIN),
+                         HYSTART_DELAY_MAX);
+
+    if (cc->round_start) {
+        c->round_min_rtt = INFINITY;
+        c->round_samples = 0;
+    }
+
+    if (cc->cwnd < HYSTART_LOW_WINDOW)
+        return;
+
+    if (c->round_samples < HYSTART_MIN_SAMPLES) {
+        c->round_min_rtt = fmin(c->round_min_rtt, ack->rtt);
+        c->round_samples++;
+    } else if (c->round_min_rtt >= c->min_rtt + thresh) {
+        cc->ssthresh = cc->cwnd;
+    }
+}
+
+
+// The window follows W(t) = C(t - K)^3 + W_max from the last loss,
+// but grows at least as fast as Reno would have.
+static void cubic_update(struct cc *cc, const struct cc_ack *ack)
+{
+    struct cubic *c = &cc->cubic;
+    double t, target, cnt;
+
+    if (isnan(c->epoch_start)) {
+        c->epoch_start = ack->time;
+        c->w_est = cc->cwnd;
+
+        if (cc->cwnd < c->w_max) {
+            c->k = cbrt((c->w_max - cc->cwnd)/CUBIC_C);
+            c->origin_point = c->w_max;
+        } else {
+            c->k = 0;
+            c->origin_point = cc->cwnd;
+        }
+    }
+
+    // Aims for where the curve will be a round trip from now.
+    t = ack->time - c->epoch_start + c->min_rtt;
+    target = c->origin_point + CUBIC_C*pow(t - c->k, 3);
+
+    c->w_est += 3*(1 - CUBIC_BETA)/(1 + CUBIC_BETA)/cc->cwnd;
+    target = fmax(target, c->w_est);
+
+    if (target > cc->cwnd)
+        cnt = fmin(cc->cwnd/(target - cc->cwnd), 100.0*cc->cwnd);
+    else
+        cnt = 100.0*cc->cwnd;
+
+    // At least 5% a round trip until the first loss, and at most 50%.
+    if (c->w_max == 0 && cnt > 20)
+        cnt = 20;
+    if (cnt < 2)
+        cnt = 2;
+
+    cong_avoid_ai(cc, &c->cwnd_cnt, cnt);
+}
+
+
+static void cubic_on_ack(struct cc *cc, const struct cc_ack *ack)
+{
+    struct cubic *c = &cc->cubic;
+
+    if (ce_is_loss(cc, ack, &c->cwr_end)) {
+        cubic_on_loss(cc, ack->time);
+        return;
+    }
+
+    c->min_rtt = fmin(c->min_rtt, ack->rtt);
+
+    if (cwnd_limited(cc, ack)) {
+        if (cc->cwnd < cc->ssthresh)
+            cubic_hystart(cc, ack);
+
+        if (cc->cwnd < cc->ssthresh)
+            cc->cwnd++;
+        else
+            cubic_update(cc, ack);
+    }
+
+    tcp_pacing_rate(cc);
+}
+
+
+static void cubic_trace(const struct cc *cc, struct trace_record *record)
+{
+    record->min_rtt = isinf(cc->cubic.min_rtt) ? 0 : cc->cubic.min_rtt;
+}
+
+
+static const struct cc_ops cubic_ops = {
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_loss = cubic_on_loss,
+    .trace = cubic_trace,
+};
+
+
+/*** BBR ***/
+
+static double bbr_max_bw(const struct bbr *b)
+{
+    double bw = 0;
+
+    for (int i = 0; i < BBR_BW_ROUNDS; i++)
+        bw = fmax(bw, b->bw[i]);
+
+    return bw;
+}
+
+
+// Packets in gain BDPs, or the initial window before there is a model.
+static double bbr_bdp(const struct cc *cc, double gain)
+{
+    const struct bbr *b = &cc->bbr;
+
+    if (isinf(b->min_rtt))
+        return INIT_CWND;
+
+    return gain*bbr_max_bw(b)*b->min_rtt/cc->mss;
+}
+
+
+static void bbr_advance_cycle_phase(struct bbr *b, double time)
+{
+    b->cycle_idx = (b->cycle_idx + 1)%BBR_CYCLE_LEN;
+    b->cycle_stamp = time;
+    b->pacing_gain = bbr_pacing_gains[b->cycle_idx];
+}
+
+
+static void bbr_enter_probe_bw(struct bbr *b, double time, unsigned int phase)
+{
+    b->mode = BBR_PROBE_BW;
+    b->cwnd_gain = BBR_CWND_GAIN;
+    b->cycle_idx = phase;
+    bbr_advance_cycle_phase(b, time);
+}
+
+
+// As bbr_save_cwnd(), what to restore after recovery or PROBE_RTT.
+static void bbr_save_cwnd(struct cc *cc)
+{
+    struct bbr *b = &cc->bbr;
+
+    if (isnan(b->recovery_end) && b->mode != BBR_PROBE_RTT)
+        b->prior_cwnd = cc->cwnd;
+    else if (cc->cwnd > b->prior_cwnd)
+        b->prior_cwnd = cc->cwnd;
+}
+
+
+static void bbr_init(struct cc *cc, double time, long seed)
+{
+    struct bbr *b = &cc->bbr;
+
+    cc->cwnd = INIT_CWND;
+    cc->ssthresh = SSTHRESH_INF;
+
+    b->mode = BBR_STARTUP;
+    b->pacing_gain = BBR_HIGH_GAIN;
+    b->cwnd_gain = BBR_HIGH_GAIN;
+    b->min_rtt = INFINITY;
+    b->min_rtt_stamp = time;
+    b->probe_rtt_done = NAN;
+    b->recovery_end = NAN;
+
+    // Where PROBE_BW will start, anywhere but the phase that drains.
+    b->cycle_idx = BBR_CYCLE_LEN - 1 - seed%(BBR_CYCLE_LEN - 1);
+}
+
+
+static bool bbr_is_next_cycle_phase(const struct cc *cc,
+                                    const struct cc_ack *ack)
+{
+    const struct bbr *b = &cc->bbr;
+    bool full_length = ack->time - b->cycle_stamp > b->min_rtt;
+
+    // Probing lasts until the extra data is in flight, draining until
+    // what was queued is gone.
+    if (b->pacing_gain > 1)
+        return full_length && ack->inflight >= bbr_bdp(cc, b->pacing_gain);
+    else if (b->pacing_gain < 1)
+        return full_length || ack->inflight <= bbr_bdp(cc, 1);
+    else
+        return full_length;
+}
+
+
+static void bbr_update_model(struct cc *cc, const struct cc_ack *ack)
+{
+    struct bbr *b = &cc->bbr;
+    double *slot = &b->bw[cc->rounds%BBR_BW_ROUNDS];
+    double bw = ack->interval > 0 ? ack->delivered*cc->mss/ack->interval : 0;
+    bool expired = ack->time > b->min_rtt_stamp + BBR_MIN_RTT_WIN;
+
+    if (cc->round_start)
+        *slot = 0;
+
+    // App-limited samples only count if they raise the estimate.
+    if (!ack->app_limited || bw >= bbr_max_bw(b))
+        *slot = fmax(*slot, bw);
+
+    if (b->mode == BBR_PROBE_BW && bbr_is_next_cycle_phase(cc, ack))
+        bbr_advance_cycle_phase(b, ack->time);
+
+    if (!b->full_bw_reached && cc->round_start && !ack->app_limited) {
+        if (bbr_max_bw(b) >= b->full_bw*BBR_FULL_BW_THRESH) {
+            b->full_bw = bbr_max_bw(b);
+            b->full_bw_cnt = 0;
+        } else if (++b->full_bw_cnt >= BBR_FULL_BW_CNT) {
+            b->full_bw_reached = true;
+        }
+    }
+
+    if (b->mode == BBR_STARTUP && b->full_bw_reached) {
+        b->mode = BBR_DRAIN;
+        b->pacing_gain = 1/BBR_HIGH_GAIN;
+    }
+
+    if (b->mode == BBR_DRAIN && ack->inflight <= bbr_bdp(cc, 1))
+        bbr_enter_probe_bw(b, ack->time, b->cycle_idx);
+
+    if (ack->rtt < b->min_rtt || expired) {
+        b->min_rtt = ack->rtt;
+        b->min_rtt_stamp = ack->time;
+    }
+
+    if (expired && b->mode != BBR_PROBE_RTT) {
+        bbr_save_cwnd(cc);
+        b->mode = BBR_PROBE_RTT;
+        b->pacing_gain = 1;
+        b->cwnd_gain = 1;
+        b->probe_rtt_done = NAN;
+    }
+
+    // Hold the floor for BBR_PROBE_RTT_TIME and a round trip.
+    if (b->mode == BBR_PROBE_RTT) {
+        if (isnan(b->probe_rtt_done) && ack->inflight <= BBR_MIN_CWND) {
+            b->probe_rtt_done = ack->time + BBR_PROBE_RTT_TIME;
+            b->probe_rtt_round_done = false;
+            cc->next_round_delivered = cc->delivered;
+        } else if (!isnan(b->probe_rtt_done)) {
+            b->probe_rtt_round_done |= cc->round_start;
+
+            if (b->probe_rtt_round_done && ack->time >= b->probe_rtt_done) {
+                b->min_rtt_stamp = ack->time;
+                cc->cwnd = cc->cwnd > b->prior_cwnd ? cc->cwnd : b->prior_cwnd;
+
+                if (b->full_bw_reached) {
+                    bbr_enter_probe_bw(b, ack->time, b->cycle_idx);
+                } else {
+                    b->mode = BBR_STARTUP;
+                    b->pacing_gain = BBR_HIGH_GAIN;
+                    b->cwnd_gain = BBR_HIGH_GAIN;
+                }
+            }
+        }
+    }
+}
+
+
+static void bbr_on_ack(struct cc *cc, const struct cc_ack *ack)
+{
+    struct bbr *b = &cc->bbr;
+    double rate, target;
+
+    bbr_update_model(cc, ack);
+
+    // Never lowered until the pipe is known to be full.
+    rate = BBR_PACING_MARGIN*b->pacing_gain*bbr_max_bw(b);
+    if (b->full_bw_reached || rate > cc->pacing_rate)
+        cc->pacing_rate = rate;
+
+    // Room for the ACK aggregation of a few packets, as bbr's
+    // quantization budget, and more while probing.
+    target = bbr_bdp(cc, b->cwnd_gain) + 3;
+    if (b->mode == BBR_PROBE_BW && b->cycle_idx == 0)
+        target += 2;
+
+    // As bbr_set_cwnd_to_recover_or_restore(): send one packet for each
+    // one delivered in the first round of recovery, and go back to the
+    // window from before it once it is over.
+    if (cc->round_start)
+        b->packet_conservation = false;
+
+    if (!isnan(b->recovery_end) && ack->time >= b->recovery_end) {
+        b->recovery_end = NAN;
+        b->packet_conservation = false;
+        if (cc->cwnd < b->prior_cwnd)
+            cc->cwnd = b->prior_cwnd;
+    }
+
+    if (b->packet_conservation) {
+        if (cc->cwnd < ack->inflight)
+            cc->cwnd = ack->inflight;
+    } else if (b->full_bw_reached) {
+        cc->cwnd = fmin(cc->cwnd + 1, target);
+    } else if (cc->cwnd < target || cc->delivered < INIT_CWND) {
+        cc->cwnd++;
+    }
+
+    if (cc->cwnd < BBR_MIN_CWND)
+        cc->cwnd = BBR_MIN_CWND;
+    if (b->mode == BBR_PROBE_RTT && cc->cwnd > BBR_MIN_CWND)
+        cc->cwnd = BBR_MIN_CWND;
+}
+
+
+// BBR v1 keeps its model through losses, and only holds back what it
+// sends until they are repaired.
+static void bbr_on_loss(struct cc *cc, double time)
+{
+    struct bbr *b = &cc->bbr;
+
+    if (isnan(b->recovery_end)) {
+        bbr_save_cwnd(cc);
+        b->packet_conservation = true;
+
+        // Start a round now, so conservation lasts until what is sent
+        // from here on is delivered.
+        cc->next_round_delivered = cc->delivered;
+    }
+
+    b->recovery_end = time + cc->srtt;
+}
+
+
+// Down to what is in flight while conserving packets, and one less for
+// every other loss.
+static void bbr_on_packet_lost(struct cc *cc, unsigned long inflight)
+{
+    if (cc->bbr.packet_conservation && cc->cwnd > inflight)
+        cc->cwnd = inflight;
+    else if (!cc->bbr.packet_conservation && cc->cwnd > 0)
+        cc->cwnd--;
+
+    if (cc->cwnd < BBR_MIN_CWND)
+        cc->cwnd = BBR_MIN_CWND;
+}
+
+
+static void bbr_trace(const struct cc *cc, struct trace_record *record)
+{
+    record->mode = cc->bbr.mode;
+    record->min_rtt = isinf(cc->bbr.min_rtt) ? 0 : cc->bbr.min_rtt;
+    record->bdp = bbr_bdp(cc, 1);
+}
+
+
+static const struct cc_ops bbr_ops = {
+    .init = bbr_init,
+    .on_ack = bbr_on_ack,
+    .on_loss = bbr_on_loss,
+    .on_packet_lost = bbr_on_packet_lost,
+    .trace = bbr_trace,
+};
+
+
+/*** Interface ***/
+
+void cc_init(struct cc *cc, enum cc_algorithm algorithm,
+             const struct davis_params *params, double time,
+             unsigned long mss, bool pacing, long seed)
+{
+    static const struct cc_ops *const ops[NUM_CC] = {
+        [CC_DAVIS] = &davis_ops,
+        [CC_RENO] = &reno_ops,
+        [CC_CUBIC] = &cubic_ops,
+        [CC_BBR] = &bbr_ops,
+    };
+
+    memset(cc, 0, sizeof(*cc));
+
+    cc->ops = ops[algorithm];
+    cc->algorithm = algorithm;
+    cc->params = params;
+    cc->mss = mss;
+    cc->pacing = pacing || algorithm == CC_BBR;
+
+    cc->ops->init(cc, time, seed);
+}
+
+
+void cc_on_ack(struct cc *cc, const struct cc_ack *ack)
+{
+    cc->srtt = cc->srtt > 0 ? 0.875*cc->srtt + 0.125*ack->rtt : ack->rtt;
+
+    // A round trip ends when a packet sent after it began is delivered.
+    cc->delivered++;
+    cc->round_start = cc->delivered - ack->delivered >= cc->next_round_delivered;
+    if (cc->round_start) {
+        cc->next_round_delivered = cc->delivered;
+        cc->rounds++;
+    }
+
+    cc->ops->on_ack(cc, ack);
+}
+
+
+void cc_on_loss(struct cc *cc, double time)
+{
+    cc->ops->on_loss(cc, time);
+}
+
+
+void cc_on_packet_lost(struct cc *cc, unsigned long inflight)
+{
+    if (cc->ops->on_packet_lost != NULL)
+        cc->ops->on_packet_lost(cc, inflight);
+}
+
+
+void cc_trace(const struct cc *cc, struct trace_record *record)
+{
+    record->cwnd = cc->cwnd;
+    record->pacing_rate = cc->pacing_rate;
+
+    if (cc->ops->trace != NULL)
+        cc->ops->trace(cc, record);
+}
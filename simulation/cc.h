@@ -0,0 +1,135 @@
+
+#include <stdbool.h>
+
+#include "davis.h"
+#include "trace.h"
+
+#ifndef _CC_H_
+#define _CC_H_
+
+
+enum cc_algorithm { CC_DAVIS, CC_RENO, CC_CUBIC, CC_BBR, NUM_CC };
+
+extern const char *const cc_names[NUM_CC];
+
+// One ACK, each of which delivers a single packet.
+struct cc_ack {
+    double time;
+    double rtt;
+    unsigned long delivered;    // Over interval, as a tcp_rate.c sample
+    double interval;
+    bool app_limited;
+    bool ce;
+    unsigned long inflight;     // Before this ACK, like prior_in_flight
+};
+
+struct cc;
+
+// The simulator's tcp_congestion_ops. Algorithms set cwnd, ssthresh and
+// pacing_rate in struct cc, and on_loss is called once per loss episode.
+struct cc_ops {
+    void (*init)(struct cc *cc, double time, long seed);
+    void (*on_ack)(struct cc *cc, const struct cc_ack *ack);
+    void (*on_loss)(struct cc *cc, double time);
+
+    // Optional, called for every lost packet (after on_loss for the
+    // first of an episode) with what is still in flight, as rs->losses.
+    void (*on_packet_lost)(struct cc *cc, unsigned long inflight);
+
+    // Fills in the algorithm specific fields of a trace record.
+    void (*trace)(const struct cc *cc, struct trace_record *record);
+};
+
+struct reno {
+    u32 cwnd_cnt;               // ACKs towards the next increase
+    double cwr_end;             // Ignore CE marks until then
+};
+
+// RFC 8312 with Linux's constants and delay based HyStart.
+struct cubic {
+    u32 cwnd_cnt;
+    double cwr_end;
+
+    double w_max;
+    double epoch_start;         // NAN outside congestion avoidance
+    double origin_point;
+    double k;
+    double w_est;               // What Reno would have by now
+    double min_rtt;
+
+    double round_min_rtt;       // HyStart's, over the round's first ACKs
+    unsigned int round_samples;
+};
+
+enum bbr_mode { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW, BBR_PROBE_RTT };
+
+#define BBR_BW_ROUNDS 10
+#define BBR_CYCLE_LEN 8
+
+// BBR v1 as in Linux's tcp_bbr.c.
+struct bbr {
+    enum bbr_mode mode;
+
+    double bw[BBR_BW_ROUNDS];   // Max delivery rate of each recent round
+    double min_rtt;
+    double min_rtt_stamp;
+    double probe_rtt_done;      // NAN until the PROBE_RTT floor is reached
+    bool probe_rtt_round_done;
+
+    double full_bw;
+    unsigned int full_bw_cnt;
+    bool full_bw_reached;
+
+    unsigned int cycle_idx;
+    double cycle_stamp;
+
+    double pacing_gain;
+    double cwnd_gain;
+    u32 prior_cwnd;             // Restored after recovery or PROBE_RTT
+
+    // Loss recovery lasts a round trip, NAN outside it. Its first round
+    // only sends as much as is delivered.
+    double recovery_end;
+    bool packet_conservation;
+};
+
+struct cc {
+    const struct cc_ops *ops;
+    enum cc_algorithm algorithm;
+    const struct davis_params *params;
+    unsigned long mss;
+    bool pacing;                // Always on for BBR
+
+    u32 cwnd;
+    u32 ssthresh;
+    double pacing_rate;         // Bytes/s, 0 when not pacing
+    double srtt;
+
+    // Round trips as tcp_rate.c counts them, by delivered packets.
+    unsigned long delivered;
+    unsigned long next_round_delivered;
+    unsigned long rounds;
+    bool round_start;
+
+    union {
+        struct davis_sim davis;
+        struct reno reno;
+        struct cubic cubic;
+        struct bbr bbr;
+    };
+};
+
+
+bool cc_parse(const char *name, enum cc_algorithm *algorithm);
+
+void cc_init(struct cc *cc, enum cc_algorithm algorithm,
+             const struct davis_params *params, double time,
+             unsigned long mss, bool pacing, long seed);
+void cc_on_ack(struct cc *cc, const struct cc_ack *ack);
+void cc_on_loss(struct cc *cc, double time);
+void cc_on_packet_lost(struct cc *cc, unsigned long inflight);
+void cc_trace(const struct cc *cc, struct trace_record *record);
+
+
+
+#endif /* _CC_H_ */
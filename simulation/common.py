@@ -1,5 +1,50 @@
 
 import numpy as np
+import pandas as pd
+
+
+# Layout of the binary traces written by `simulation -B`. These must
+# match struct trace_header and struct trace_record in trace.h.
+TRACE_MAGIC = b'DAVISTR1'
+TRACE_VERSION = 1
+
+traceHeaderDtype = np.dtype([('magic', 'S8'), ('version', '=u4'),
+                             ('record_size', '=u4')])
+
+traceDtype = np.dtype([
+    ('flow_id', '=u4'), ('mode', '=u4'),
+    ('time', '=f8'), ('rtt', '=f8'), ('min_rtt', '=f8'),
+    ('pacing_rate', '=f8'), ('bytes_sent', '=u8'),
+    ('cwnd', '=u4'), ('gain_cwnd', '=u4'), ('bdp', '=u4'),
+    ('losses', '=u4')])
+
+
+def readTrace(fileName):
+    """
+    Read a simulation trace in either output format.
+
+    Binary traces are memory-mapped rather than parsed, so columns are
+    only paged in as they are used. Both formats support attribute
+    access to columns (data.time) and boolean row selection
+    (data[data.flow_id == 0]).
+    """
+    with open(fileName, 'rb') as f:
+        magic = f.read(len(TRACE_MAGIC))
+
+    if magic != TRACE_MAGIC:
+        return pd.read_csv(fileName)
+
+    header = np.fromfile(fileName, dtype=traceHeaderDtype, count=1)[0]
+
+    if header['version'] != TRACE_VERSION or header['record_size'] != traceDtype.itemsize:
+        raise RuntimeError("{} has an unsupported trace version {} ({} byte records)".format(
+            fileName, header['version'], header['record_size']))
+
+    data = np.memmap(fileName, dtype=traceDtype, mode='r',
+                     offset=traceHeaderDtype.itemsize)
+
+    return data.view(np.recarray)
+
 
 
 def calcRates(times, bytesSent, interval=None):
@@ -1,5 +1,4 @@
 
-#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,233 +7,68 @@
 #include "davis.h"
 
 
-static const unsigned long MIN_CWND = 4;
-static const unsigned long MAX_CWND = 33554432;//32768;
-
-static const unsigned long MIN_GAIN_CWND = 4;
-static double REACTIVITY = 1.0/8.0;
-static double SENSITIVITY = 1.0/64.0;
-
-static const unsigned long DRAIN_RTTS = 2;
-static const unsigned long STABLE_RTTS_MIN = 3;
-static const unsigned long STABLE_RTTS_MAX = 6;
-static const unsigned long GAIN_1_RTTS = 2;
-static const unsigned long GAIN_2_RTTS = 1;
-
-static const double RTT_INF = 10;
-static const double RTT_TIMEOUT = 10;
-
-
-#define min(x, y) ((x) < (y) ? (x) : (y))
-#define max(x, y) ((x) > (y) ? (x) : (y))
-#define clamp(x, mn, mx) (min(max((x), (mn)), (mx)))
-
-
-static inline bool in_slow_start(struct davis *d)
+static inline u64 usecs(double time)
 {
-    return d->cwnd < d->ssthresh;
+    return llround(time*USEC_PER_SEC);
 }
 
 
-static void enter_slow_start(struct davis *d, double time)
+void davis_params_init(struct davis_params *params)
 {
-    d->mode = DAVIS_GAIN_1;
-    d->trans_time = time;
-
-    d->bdp = MIN_CWND;
-    d->last_bdp = 0;
-
-    d->cwnd = MIN_CWND;
-
-    d->min_rtt = d->last_rtt;
+    *params = (struct davis_params) DAVIS_PARAMS_INIT;
 }
 
 
-static void update_gain_cwnd(struct davis *d)
+bool davis_params_valid(const struct davis_params *params)
 {
-    // Lucas sequence
-    // Technically alpha - 1 and beta - 1
-    double alpha, beta;
-    long gain;
-
-    if (SENSITIVITY < 0) {
-        fprintf(stderr, "Bad sensitivity (%f) value, must be >= 0\n",
-                SENSITIVITY);
-
-        SENSITIVITY = 0;
-    }
+    const char *err = davis_params_check(params);
 
-    if (REACTIVITY <= SENSITIVITY) {
-        fprintf(stderr, "Bad reactivity (%f) value, must be > %f\n",
-                REACTIVITY, SENSITIVITY);
+    if (err != NULL)
+        fprintf(stderr, "Bad Davis parameters, %s\n", err);
 
-        REACTIVITY = SENSITIVITY + 1.0e-3;
-    }
-
-    alpha = 1 + REACTIVITY - SENSITIVITY/REACTIVITY;
-    beta = SENSITIVITY - alpha;
+    return err == NULL;
+}
 
-    gain = alpha*d->bdp + beta*d->last_bdp;
-    gain = max(gain, SENSITIVITY*d->bdp);
-    gain = max(gain, MIN_GAIN_CWND);
 
-    d->gain_cwnd = gain;
+static void davis_update_pacing_rate(struct davis_sim *d)
+{
+    if (d->pacing)
+        d->pacing_rate = davis_pacing_rate(&d->core, d->params, d->cwnd,
+                                           d->ssthresh, d->mss);
 }
 
 
-void davis_init(struct davis *d, double time,
-               unsigned long mss)
+void davis_init(struct davis_sim *d, const struct davis_params *params,
+                double time, unsigned long mss, bool pacing, long seed)
 {
-    d->mode = DAVIS_GAIN_1;
-    d->trans_time = time;
+    struct davis_ack ack = {usecs(time), 0, 0, 0, false, 0, 0};
 
+    d->params = params;
     d->mss = mss;
-    d->cwnd = MIN_CWND;
-    d->ssthresh = MAX_CWND;
 
-    d->delivered_start = 0;
-    d->delivered_start_time = time;
-
-    d->bdp = MIN_CWND;
-    d->last_bdp = 0;
-    d->gain_cwnd = MIN_GAIN_CWND;
-
-    srand48_r((long) d, &d->drand_buffer);
-    d->stable_rtts = STABLE_RTTS_MIN;
+    davis_core_init(&d->core, params, &ack, &d->cwnd, &d->ssthresh);
+    d->core.rand_state = (u32) seed | 1;
 
+    d->pacing = pacing;
     d->pacing_rate = 0;
-
-    d->last_rtt = 0;
-    d->min_rtt = RTT_INF;
-    d->min_rtt_time = time;
 }
 
 
-static void davis_slow_start(struct davis *d, double time, double rtt,
-                             unsigned long pkts_delivered)
+void davis_on_ack(struct davis_sim *d, double time, double rtt,
+                  unsigned long delivered, double interval, bool app_limited,
+                  bool ce)
 {
-    if (d->mode == DAVIS_GAIN_1) {
-        if (time > d->trans_time + GAIN_1_RTTS*d->last_rtt) {
-            d->mode = DAVIS_GAIN_2;
-            d->trans_time = time;
-
-            d->delivered_start = pkts_delivered;
-            d->delivered_start_time = time;
-        }
-    } else if (d->mode == DAVIS_GAIN_2) {
-        if (time > d->trans_time + GAIN_2_RTTS*d->last_rtt) {
-            unsigned long diff_deliv = pkts_delivered - d->delivered_start;
-            double interval = time - d->delivered_start_time;
-
-            d->bdp = ceil(diff_deliv*d->min_rtt/interval);
-
-            if (d->bdp > d->last_bdp) {
-                d->mode = DAVIS_GAIN_1;
-                d->trans_time = time;
-
-                d->cwnd = 3*d->bdp/2;
-                d->last_bdp = d->bdp;
-            } else {
-                d->mode = DAVIS_DRAIN;
-                d->trans_time = time;
-
-                d->cwnd = MIN_CWND;
-                d->ssthresh = MIN_CWND;
-            }
-        }
-    } else {
-        enter_slow_start(d, time);
-    }
-}
-
+    // Every simulated ACK acknowledges one packet.
+    struct davis_ack ack = {usecs(time), usecs(rtt), delivered, usecs(interval),
+                            app_limited, 1, ce};
 
-void davis_on_ack(struct davis *d, double time, double rtt,
-                  unsigned long pkts_delivered)
-{
-    if (rtt > 0) {
-        d->last_rtt = rtt;
-
-        if (rtt <= d->min_rtt) {
-            d->min_rtt = rtt;
-            d->min_rtt_time = time;
-        }
-    }
-
-
-    if (in_slow_start(d)) {
-        davis_slow_start(d, time, rtt, pkts_delivered);
-    } else if (d->mode == DAVIS_DRAIN) {
-        if (time > d->trans_time + DRAIN_RTTS*d->last_rtt) {
-            d->mode = DAVIS_STABLE;
-            d->trans_time = time;
-
-            d->cwnd = d->bdp;
-        }
-    } else if (d->mode == DAVIS_STABLE) {
-        if (time > d->trans_time + d->stable_rtts*d->last_rtt) {
-            d->mode = DAVIS_GAIN_1;
-            d->trans_time = time;
-
-            d->cwnd = d->bdp + d->gain_cwnd;
-        }
-    } else if (d->mode == DAVIS_GAIN_1) {
-        if (time > d->trans_time + GAIN_1_RTTS*d->last_rtt) {
-            d->mode = DAVIS_GAIN_2;
-            d->trans_time = time;
-
-            d->delivered_start = pkts_delivered;
-            d->delivered_start_time = time;
-        }
-    } else if (d->mode == DAVIS_GAIN_2) {
-        if (time > d->trans_time + GAIN_2_RTTS*d->last_rtt) {
-            unsigned long diff_deliv = pkts_delivered - d->delivered_start;
-            double interval = time - d->delivered_start_time;
-
-            d->last_bdp = d->bdp;
-            d->bdp = ceil(diff_deliv*d->min_rtt/interval);
-
-            update_gain_cwnd(d);
-
-
-            if (time > d->min_rtt_time + RTT_TIMEOUT) {
-                d->mode = DAVIS_DRAIN;
-                d->trans_time = time;
-
-                d->cwnd = MIN_CWND;
-                d->min_rtt = d->last_rtt;
-                d->min_rtt_time = time;
-            } else {
-                d->mode = DAVIS_STABLE;
-                d->trans_time = time;
-
-                lrand48_r(&d->drand_buffer, (long*) &d->stable_rtts);
-                d->stable_rtts %= STABLE_RTTS_MAX - STABLE_RTTS_MIN + 1;
-                d->stable_rtts += STABLE_RTTS_MIN;
-
-                d->cwnd = d->bdp;
-            }
-        }
-    } else {
-        fprintf(stderr, "Got to undefined mode %d at time %f\n", d->mode, time);
-
-        d->mode = DAVIS_DRAIN;
-        d->trans_time = time;
-
-        d->cwnd = MIN_CWND;
-    }
-
-    d->cwnd = clamp(d->cwnd, MIN_CWND, MAX_CWND);
-    d->pacing_rate = 0;
+    davis_core_on_ack(&d->core, d->params, &ack, &d->cwnd, &d->ssthresh);
+    davis_update_pacing_rate(d);
 }
 
 
-void davis_on_loss(struct davis *d, double time)
+void davis_on_loss(struct davis_sim *d, double time)
 {
-    if (in_slow_start(d)) {
-        d->mode = DAVIS_DRAIN;
-        d->trans_time = time;
-
-        d->cwnd = MIN_CWND;
-        d->ssthresh = MIN_CWND;
-    }
+    davis_core_on_loss(&d->core, d->params, usecs(time), &d->cwnd, &d->ssthresh);
+    davis_update_pacing_rate(d);
 }
@@ -1,42 +1,37 @@
 
 #include <stdbool.h>
 
+#include "davis_core.h"
+
 #ifndef _DAVIS_H_
 #define _DAVIS_H_
 
 
-enum davis_mode { DAVIS_DRAIN, DAVIS_STABLE, DAVIS_GAIN_1, DAVIS_GAIN_2 };
-
-struct davis {
-    enum davis_mode mode;
-    double trans_time;
+// A simulated Davis sender. All congestion control decisions are made
+// by davis_core.h, exactly as in the kernel module; this only converts
+// between the simulator's seconds and the core's microseconds.
+struct davis_sim {
+    struct davis core;
+    const struct davis_params *params;
 
     unsigned long mss;
-    unsigned long cwnd;
-    unsigned long ssthresh;
-
-    unsigned long delivered_start;
-    double delivered_start_time;
-
-    unsigned long bdp;
-    unsigned long last_bdp;
-    unsigned long gain_cwnd;
+    u32 cwnd;
+    u32 ssthresh;
 
-    struct drand48_data drand_buffer;
-    unsigned long stable_rtts;
-
-    double pacing_rate;
-
-    double last_rtt;
-    double min_rtt, min_rtt_time;
+    bool pacing;
+    double pacing_rate;         // Bytes/s, 0 when not pacing
 };
 
 
-void davis_init(struct davis *d, double time,
-               unsigned long mss);
-void davis_on_ack(struct davis *d, double time, double rtt,
-                 unsigned long pkts_delivered);
-void davis_on_loss(struct davis *d, double time);
+void davis_params_init(struct davis_params *params);
+bool davis_params_valid(const struct davis_params *params);
+
+void davis_init(struct davis_sim *d, const struct davis_params *params,
+                double time, unsigned long mss, bool pacing, long seed);
+void davis_on_ack(struct davis_sim *d, double time, double rtt,
+                  unsigned long delivered, double interval, bool app_limited,
+                  bool ce);
+void davis_on_loss(struct davis_sim *d, double time);
 
 
 #endif /* _DAVIS_H_ */
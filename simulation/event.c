@@ -0,0 +1,94 @@
+
+#include <stdio.h>
+
+#include "event.h"
+
+
+static inline bool event_before(const struct event *a, const struct event *b)
+{
+    if (a->time != b->time)
+        return a->time < b->time;
+    else if (a->type != b->type)
+        return a->type < b->type;
+    else
+        return a->flow < b->flow;
+}
+
+
+void event_queue_push(struct event_queue *queue, double time,
+                      enum event_type type, size_t flow)
+{
+    struct event event = {time, type, flow};
+    size_t i;
+
+    if (queue->length == queue->capacity) {
+        size_t capacity = queue->capacity > 0 ? 2*queue->capacity : 64;
+        struct event *events = realloc(queue->events,
+                                       capacity*sizeof(struct event));
+
+        if (events == NULL) {
+            fprintf(stderr, "Could not grow event queue to %zu events\n",
+                    capacity);
+            exit(1);
+        }
+
+        queue->capacity = capacity;
+        queue->events = events;
+    }
+
+    i = queue->length++;
+
+    while (i > 0) {
+        size_t parent = (i - 1)/2;
+
+        if (!event_before(&event, &queue->events[parent]))
+            break;
+
+        queue->events[i] = queue->events[parent];
+        i = parent;
+    }
+
+    queue->events[i] = event;
+}
+
+
+bool event_queue_pop(struct event_queue *queue, struct event *event)
+{
+    struct event last;
+    size_t i = 0;
+
+    if (queue->length == 0)
+        return false;
+
+    *event = queue->events[0];
+    last = queue->events[--queue->length];
+
+    while (2*i + 1 < queue->length) {
+        size_t child = 2*i + 1;
+
+        if (child + 1 < queue->length
+            && event_before(&queue->events[child + 1], &queue->events[child]))
+            child++;
+
+        if (!event_before(&queue->events[child], &last))
+            break;
+
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+
+    if (queue->length > 0)
+        queue->events[i] = last;
+
+    return true;
+}
+
+
+void event_queue_free(struct event_queue *queue)
+{
+    free(queue->events);
+
+    queue->length = 0;
+    queue->capacity = 0;
+    queue->events = NULL;
+}
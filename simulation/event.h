@@ -0,0 +1,41 @@
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+
+// Events scheduled at the same time are handled in the order they
+// are declared here, and then by flow. ARRIVAL is a flow's packet
+// reaching its first link, DEPARTURE a link finishing a packet, and
+// FORWARD a packet reaching the end of a link's delay.
+enum event_type { ARRIVAL, DEPARTURE, FORWARD, SEND };
+
+struct event {
+    double time;
+    enum event_type type;
+    size_t flow;                // The link for DEPARTURE and FORWARD
+};
+
+// Binary min-heap of events keyed on time.
+struct event_queue {
+    size_t length;
+    size_t capacity;
+    struct event *events;
+};
+
+
+#define event_queue_empty {0, 0, NULL}
+
+
+void event_queue_push(struct event_queue *queue, double time,
+                      enum event_type type, size_t flow);
+
+bool event_queue_pop(struct event_queue *queue, struct event *event);
+
+void event_queue_free(struct event_queue *queue);
+
+
+
+#endif /* _EVENT_H_ */
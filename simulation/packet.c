@@ -1,41 +1,157 @@
 
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "packet.h"
 
 
 
+static void packet_buffer_grow(struct packet_buffer *buf)
+{
+    size_t capacity = buf->capacity > 0 ? 2*buf->capacity : 64;
+    struct packet *packets = realloc(buf->packets,
+                                     capacity*sizeof(struct packet));
+
+    if (packets == NULL) {
+        fprintf(stderr, "Could not grow packet buffer to %zu packets\n",
+                capacity);
+        exit(1);
+    }
+
+    // Unwrap the packets that sit before head in the old ring.
+    if (buf->head + buf->length > buf->capacity) {
+        size_t wrapped = buf->head + buf->length - buf->capacity;
+        memcpy(&packets[buf->capacity], packets,
+               wrapped*sizeof(struct packet));
+    }
+
+    buf->capacity = capacity;
+    buf->packets = packets;
+}
+
+
 void packet_buffer_enqueue(struct packet_buffer *buf,
+                           const struct packet *packet)
+{
+    if (buf->length == buf->capacity)
+        packet_buffer_grow(buf);
+
+    buf->packets[(buf->head + buf->length) & (buf->capacity - 1)] = *packet;
+    buf->length++;
+
+    if (buf->length > buf->peak)
+        buf->peak = buf->length;
+}
+
+
+bool packet_buffer_dequeue(struct packet_buffer *buf,
                            struct packet *packet)
 {
-    if (buf->head == NULL) {
-        buf->head = packet;
-        buf->tail = packet;
-    } else {
-        buf->tail->next = packet;
-        buf->tail = packet;
+    if (buf->length == 0)
+        return false;
+
+    *packet = buf->packets[buf->head];
+    buf->head = (buf->head + 1) & (buf->capacity - 1);
+    buf->length--;
+
+    return true;
+}
+
+
+struct packet* packet_buffer_peek(struct packet_buffer *buf)
+{
+    if (buf->length == 0)
+        return NULL;
+    else
+        return &buf->packets[buf->head];
+}
+
+
+void packet_buffer_free(struct packet_buffer *buf)
+{
+    free(buf->packets);
+    memset(buf, 0, sizeof(*buf));
+}
+
+
+static void* ring_realloc(void *ring, size_t capacity, size_t size)
+{
+    ring = realloc(ring, capacity*size);
+
+    if (ring == NULL) {
+        fprintf(stderr, "Could not grow timed buffer to %zu packets\n",
+                capacity);
+        exit(1);
     }
 
+    return ring;
+}
+
+
+static void timed_buffer_grow(struct timed_buffer *buf)
+{
+    size_t capacity = buf->capacity > 0 ? 2*buf->capacity : 64;
+    size_t wrapped = 0;
+
+    buf->packets = ring_realloc(buf->packets, capacity, sizeof(struct packet));
+    buf->times = ring_realloc(buf->times, capacity, sizeof(double));
+
+    // As in packet_buffer_grow().
+    if (buf->head + buf->length > buf->capacity)
+        wrapped = buf->head + buf->length - buf->capacity;
+
+    memcpy(&buf->packets[buf->capacity], buf->packets,
+           wrapped*sizeof(struct packet));
+    memcpy(&buf->times[buf->capacity], buf->times,
+           wrapped*sizeof(double));
+
+    buf->capacity = capacity;
+}
+
+
+void timed_buffer_enqueue(struct timed_buffer *buf, const struct packet *packet,
+                          double time)
+{
+    size_t i;
+
+    if (buf->length == buf->capacity)
+        timed_buffer_grow(buf);
+
+    i = (buf->head + buf->length) & (buf->capacity - 1);
+    buf->packets[i] = *packet;
+    buf->times[i] = time;
     buf->length++;
 }
 
 
-struct packet* packet_buffer_dequeue(struct packet_buffer *buf)
+bool timed_buffer_dequeue(struct timed_buffer *buf, struct packet *packet,
+                          double *time)
 {
-    struct packet *packet = buf->head;
+    if (buf->length == 0)
+        return false;
 
-    if (packet != NULL) {
-        buf->head = packet->next;
-        packet->next = NULL;
-        buf->length--;
-    }
+    *packet = buf->packets[buf->head];
+    *time = buf->times[buf->head];
+    buf->head = (buf->head + 1) & (buf->capacity - 1);
+    buf->length--;
+
+    return true;
+}
 
-    if (buf->head == NULL)
-        buf->tail = NULL;
 
-    return packet;
+double timed_buffer_next(const struct timed_buffer *buf)
+{
+    if (buf->length == 0)
+        return NAN;
+    else
+        return buf->times[buf->head];
 }
 
 
-struct packet* packet_buffer_peek(struct packet_buffer *buf)
+void timed_buffer_free(struct timed_buffer *buf)
 {
-    return buf->head;
+    free(buf->packets);
+    free(buf->times);
+    memset(buf, 0, sizeof(*buf));
 }
@@ -1,34 +1,96 @@
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifndef _PACKET_H_
 #define _PACKET_H_
 
 
+// Send times are stored as fixed-point ticks so that a packet record
+// fits in 16 bytes.
+#define PACKET_TICKS_PER_SEC 1000000000ULL
+
 struct packet {
-    size_t flow_id;
-    double send_time;
-    struct packet *next;
-};
+    uint32_t flow_id : 24;
+    uint32_t hop : 6;           // Position in the flow's route
+    uint32_t ect : 1;
+    uint32_t ce : 1;
+    uint32_t delivered;         // Low bits of the flow's delivered count
+                                // when sent, see packet_delivered()
+    uint64_t send_ticks;
+} __attribute__((packed));
 
+// Growable ring buffer of packets. The capacity is always zero or a
+// power of two.
 struct packet_buffer {
     size_t length;
-    struct packet *head;
-    struct packet *tail;
+    size_t head;
+    size_t capacity;
+    size_t peak;
+    struct packet *packets;
+};
+
+
+#define packet_buffer_empty {0, 0, 0, 0, NULL}
+
+
+// Growable ring buffer of packets, each with a time such as when it
+// was queued or when it is due out.
+struct timed_buffer {
+    size_t length;
+    size_t head;
+    size_t capacity;
+    struct packet *packets;
+    double *times;
 };
 
 
-#define packet_buffer_empty {0, NULL, NULL}
+#define timed_buffer_empty {0, 0, 0, NULL, NULL}
+
+
+static inline uint64_t packet_ticks(double time)
+{
+    return time*PACKET_TICKS_PER_SEC + 0.5;
+}
+
+static inline double packet_send_time(const struct packet *packet)
+{
+    return (double) packet->send_ticks/PACKET_TICKS_PER_SEC;
+}
+
+// The flow's full delivered count when the packet was sent, given the
+// current one. A flow never has 2^32 packets in flight, so the low bits
+// are enough.
+static inline unsigned long packet_delivered(const struct packet *packet,
+                                             unsigned long delivered)
+{
+    return delivered - (uint32_t) (delivered - packet->delivered);
+}
 
 
 void packet_buffer_enqueue(struct packet_buffer *buf,
-                           struct packet *packet);
+                           const struct packet *packet);
 
-struct packet* packet_buffer_dequeue(struct packet_buffer *buf);
+bool packet_buffer_dequeue(struct packet_buffer *buf,
+                           struct packet *packet);
 
 struct packet* packet_buffer_peek(struct packet_buffer *buf);
 
+void packet_buffer_free(struct packet_buffer *buf);
+
+
+void timed_buffer_enqueue(struct timed_buffer *buf, const struct packet *packet,
+                          double time);
+
+bool timed_buffer_dequeue(struct timed_buffer *buf, struct packet *packet,
+                          double *time);
+
+// The next packet's time, or NAN if there is none.
+double timed_buffer_next(const struct timed_buffer *buf);
+
+void timed_buffer_free(struct timed_buffer *buf);
+
 
 
 #endif /* _PACKET_H_ */
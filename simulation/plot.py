@@ -7,7 +7,7 @@ import pandas as pd
 import matplotlib as mpl
 import matplotlib.pyplot as plt
 
-from common import calcRates
+from common import calcRates, readTrace
 
 
 parser = argparse.ArgumentParser(description="Plot")
@@ -29,8 +29,8 @@ mpl.style.use('seaborn-bright')
 mpl.rc('figure', dpi=200)
 
 
-data = pd.read_csv(args.data_file)
-data = data.loc[data.flow_id == args.flow]
+data = readTrace(args.data_file)
+data = data[data.flow_id == args.flow]
 time = data.time
 
 rate = calcRates(time, data['bytes_sent'], interval=args.rate_interval)
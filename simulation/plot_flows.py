@@ -7,7 +7,7 @@ import pandas as pd
 import matplotlib as mpl
 import matplotlib.pyplot as plt
 
-from common import calcRates
+from common import calcRates, readTrace
 
 parser = argparse.ArgumentParser(description="Plot")
 parser.add_argument('data_file', type=str,
@@ -28,11 +28,11 @@ mpl.style.use('seaborn-bright')
 mpl.rc('figure', dpi=200)
 
 
-data = pd.read_csv(args.data_file)
+data = readTrace(args.data_file)
 
 flows = []
 for i in range(max(data.flow_id) + 1):
-    flows.append(data.loc[data.flow_id == i])
+    flows.append(data[data.flow_id == i])
 
 rates = []
 for flow in flows:
@@ -0,0 +1,376 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "qdisc.h"
+
+
+#define LIST_END SIZE_MAX
+
+// When fq_codel is full it drops from the head of the fattest bucket,
+// up to half of it but at most this many packets, like Linux's
+// drop_batch_size.
+#define FQ_DROP_BATCH 64
+
+
+void qdisc_init(struct qdisc *q, const struct qdisc_config *cfg, long seed)
+{
+    memset(q, 0, sizeof(*q));
+
+    q->cfg = cfg;
+    q->new_flows = (struct fq_list) {LIST_END, LIST_END};
+    q->old_flows = (struct fq_list) {LIST_END, LIST_END};
+    q->idle_since = 0;
+    srand48_r(seed, &q->rng);
+
+    if (cfg->type == QDISC_FQ || cfg->type == QDISC_FQ_CODEL) {
+        q->buckets = calloc(cfg->buckets, sizeof(struct fq_bucket));
+
+        if (q->buckets == NULL) {
+            fprintf(stderr, "Could not allocate %lu fq buckets\n",
+                    cfg->buckets);
+            exit(1);
+        }
+    }
+}
+
+
+// Marks an ECT packet if the qdisc marks rather than drops. Returns
+// false if the packet should be dropped instead.
+static bool qdisc_mark(const struct qdisc *q, struct packet *packet)
+{
+    if (!q->cfg->ecn || !packet->ect)
+        return false;
+
+    packet->ce = 1;
+    return true;
+}
+
+
+static void fifo_enqueue(struct qdisc *q, const struct packet *packet,
+                         double time, size_t limit,
+                         struct packet_buffer *dropped)
+{
+    if (q->length >= limit) {
+        packet_buffer_enqueue(dropped, packet);
+        return;
+    }
+
+    timed_buffer_enqueue(&q->fifo, packet, time);
+    q->length++;
+}
+
+
+// RED as Floyd and Jacobson describe it, with the count of packets
+// since the last drop spreading drops out evenly.
+static void red_enqueue(struct qdisc *q, const struct packet *packet,
+                        double time, size_t limit, double tx_time,
+                        struct packet_buffer *dropped)
+{
+    const struct qdisc_config *cfg = q->cfg;
+    double min_th = cfg->red_min*limit;
+    double max_th = cfg->red_max*limit;
+    struct packet marked = *packet;
+    bool drop = false;
+
+    // While idle the average decays as if the queue had been seen empty
+    // by every packet the link could have sent.
+    if (!isnan(q->idle_since)) {
+        q->red_avg *= pow(1 - cfg->red_weight, (time - q->idle_since)/tx_time);
+        q->idle_since = time;
+    }
+
+    q->red_avg += cfg->red_weight*(q->length - q->red_avg);
+
+    if (q->red_avg < min_th) {
+        q->red_count = 0;
+    } else if (q->red_avg >= max_th) {
+        drop = true;
+    } else {
+        double pb = cfg->red_prob*(q->red_avg - min_th)/(max_th - min_th);
+        double x;
+
+        q->red_count++;
+        drand48_r(&q->rng, &x);
+        drop = q->red_count*pb >= 1 || x < pb/(1 - q->red_count*pb);
+    }
+
+    if (drop) {
+        q->red_count = 0;
+
+        if (!qdisc_mark(q, &marked)) {
+            packet_buffer_enqueue(dropped, packet);
+            return;
+        }
+    }
+
+    fifo_enqueue(q, &marked, time, limit, dropped);
+}
+
+
+static inline double codel_control_law(const struct qdisc_config *cfg,
+                                       double time, unsigned long count)
+{
+    return time + cfg->interval/sqrt(count);
+}
+
+
+// Takes the head of a CoDel queue, and says whether it has been above
+// target for long enough to drop.
+static bool codel_take(struct qdisc *q, struct codel *c,
+                       struct timed_buffer *packets, double time,
+                       struct packet *packet, bool *drop)
+{
+    double enqueued;
+
+    *drop = false;
+
+    if (!timed_buffer_dequeue(packets, packet, &enqueued)) {
+        c->first_above_time = 0;
+        return false;
+    }
+
+    q->length--;
+
+    // As Linux does, never drop the last packet or so of the backlog.
+    if (time - enqueued < q->cfg->target || q->length <= 1)
+        c->first_above_time = 0;
+    else if (c->first_above_time == 0)
+        c->first_above_time = time + q->cfg->interval;
+    else if (time >= c->first_above_time)
+        *drop = true;
+
+    return true;
+}
+
+
+// CoDel's dequeue from RFC 8289, following Linux in marking instead of
+// dropping where it can.
+static bool codel_dequeue(struct qdisc *q, struct codel *c,
+                          struct timed_buffer *packets, double time,
+                          struct packet *packet, struct packet_buffer *dropped)
+{
+    const struct qdisc_config *cfg = q->cfg;
+    bool drop;
+    bool have = codel_take(q, c, packets, time, packet, &drop);
+
+    if (!have) {
+        c->dropping = false;
+        return false;
+    }
+
+    if (c->dropping) {
+        if (!drop) {
+            c->dropping = false;
+        } else {
+            while (c->dropping && time >= c->drop_next) {
+                c->count++;
+
+                if (qdisc_mark(q, packet)) {
+                    c->drop_next = codel_control_law(cfg, c->drop_next, c->count);
+                    return true;
+                }
+
+                packet_buffer_enqueue(dropped, packet);
+                have = codel_take(q, c, packets, time, packet, &drop);
+
+                if (!drop)
+                    c->dropping = false;
+                else
+                    c->drop_next = codel_control_law(cfg, c->drop_next, c->count);
+            }
+        }
+    } else if (drop) {
+        unsigned long delta;
+
+        if (!qdisc_mark(q, packet)) {
+            packet_buffer_enqueue(dropped, packet);
+            have = codel_take(q, c, packets, time, packet, &drop);
+        }
+
+        c->dropping = true;
+
+        // Pick up near the old drop rate if it stopped only recently.
+        delta = c->count - c->last_count;
+        if (delta > 1 && time - c->drop_next < 16*cfg->interval)
+            c->count = delta;
+        else
+            c->count = 1;
+
+        c->last_count = c->count;
+        c->drop_next = codel_control_law(cfg, time, c->count);
+    }
+
+    return have;
+}
+
+
+static void fq_list_append(struct qdisc *q, struct fq_list *list, size_t i)
+{
+    q->buckets[i].next = LIST_END;
+
+    if (list->head == LIST_END)
+        list->head = i;
+    else
+        q->buckets[list->tail].next = i;
+
+    list->tail = i;
+}
+
+
+static size_t fq_list_pop(struct qdisc *q, struct fq_list *list)
+{
+    size_t i = list->head;
+
+    list->head = q->buckets[i].next;
+
+    return i;
+}
+
+
+static void fq_drop(struct qdisc *q, struct packet_buffer *dropped)
+{
+    struct fq_bucket *fattest = &q->buckets[0];
+    size_t threshold;
+    struct packet packet;
+    double enqueued;
+
+    for (size_t i = 1; i < q->cfg->buckets; i++) {
+        if (q->buckets[i].packets.length > fattest->packets.length)
+            fattest = &q->buckets[i];
+    }
+
+    threshold = fattest->packets.length/2;
+
+    for (size_t i = 0; i < FQ_DROP_BATCH && (i == 0 || i < threshold); i++) {
+        timed_buffer_dequeue(&fattest->packets, &packet, &enqueued);
+        packet_buffer_enqueue(dropped, &packet);
+        q->length--;
+    }
+}
+
+
+static void fq_enqueue(struct qdisc *q, const struct packet *packet,
+                       double time, size_t limit,
+                       struct packet_buffer *dropped)
+{
+    size_t i = packet->flow_id%q->cfg->buckets;
+    struct fq_bucket *bucket = &q->buckets[i];
+
+    // Plain fq drops what arrives at a full queue, fq_codel makes room.
+    if (q->cfg->type == QDISC_FQ && q->length >= limit) {
+        packet_buffer_enqueue(dropped, packet);
+        return;
+    }
+
+    timed_buffer_enqueue(&bucket->packets, packet, time);
+    q->length++;
+
+    if (!bucket->listed) {
+        fq_list_append(q, &q->new_flows, i);
+        bucket->deficit = q->cfg->quantum;
+        bucket->listed = true;
+    }
+
+    if (q->length > limit)
+        fq_drop(q, dropped);
+}
+
+
+// Deficit round robin over the buckets, new ones first, as in RFC 8290.
+static bool fq_dequeue(struct qdisc *q, double time, struct packet *packet,
+                       struct packet_buffer *dropped)
+{
+    for (;;) {
+        struct fq_list *list = q->new_flows.head != LIST_END
+            ? &q->new_flows : &q->old_flows;
+        struct fq_bucket *bucket;
+        size_t i;
+
+        if (list->head == LIST_END)
+            return false;
+
+        i = list->head;
+        bucket = &q->buckets[i];
+
+        if (bucket->deficit <= 0) {
+            bucket->deficit += q->cfg->quantum;
+            fq_list_pop(q, list);
+            fq_list_append(q, &q->old_flows, i);
+            continue;
+        }
+
+        if (q->cfg->type == QDISC_FQ) {
+            double enqueued;
+
+            if (timed_buffer_dequeue(&bucket->packets, packet, &enqueued)) {
+                q->length--;
+                bucket->deficit--;
+                return true;
+            }
+        } else if (codel_dequeue(q, &bucket->codel, &bucket->packets, time,
+                                 packet, dropped)) {
+            bucket->deficit--;
+            return true;
+        }
+
+        // An emptied new bucket goes round the old ones once, so that a
+        // flow can't stay new by sending a packet at a time.
+        fq_list_pop(q, list);
+
+        if (list == &q->new_flows && q->old_flows.head != LIST_END)
+            fq_list_append(q, &q->old_flows, i);
+        else
+            bucket->listed = false;
+    }
+}
+
+
+void qdisc_enqueue(struct qdisc *q, const struct packet *packet, double time,
+                   size_t limit, double tx_time, struct packet_buffer *dropped)
+{
+    if (q->cfg->type == QDISC_FQ || q->cfg->type == QDISC_FQ_CODEL)
+        fq_enqueue(q, packet, time, limit, dropped);
+    else if (q->cfg->type == QDISC_RED)
+        red_enqueue(q, packet, time, limit, tx_time, dropped);
+    else
+        fifo_enqueue(q, packet, time, limit, dropped);
+
+    q->idle_since = q->length > 0 ? NAN : q->idle_since;
+}
+
+
+bool qdisc_dequeue(struct qdisc *q, double time, struct packet *packet,
+                   struct packet_buffer *dropped)
+{
+    bool have;
+    double enqueued;
+
+    if (q->cfg->type == QDISC_FQ || q->cfg->type == QDISC_FQ_CODEL) {
+        have = fq_dequeue(q, time, packet, dropped);
+    } else if (q->cfg->type == QDISC_CODEL) {
+        have = codel_dequeue(q, &q->codel, &q->fifo, time, packet, dropped);
+    } else {
+        have = timed_buffer_dequeue(&q->fifo, packet, &enqueued);
+        q->length -= have;
+    }
+
+    if (q->length == 0 && isnan(q->idle_since))
+        q->idle_since = time;
+
+    return have;
+}
+
+
+void qdisc_free(struct qdisc *q)
+{
+    if (q->buckets != NULL) {
+        for (size_t i = 0; i < q->cfg->buckets; i++)
+            timed_buffer_free(&q->buckets[i].packets);
+    }
+
+    free(q->buckets);
+    timed_buffer_free(&q->fifo);
+    memset(q, 0, sizeof(*q));
+}
@@ -0,0 +1,110 @@
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "packet.h"
+
+#ifndef _QDISC_H_
+#define _QDISC_H_
+
+
+enum qdisc_type { QDISC_DROPTAIL, QDISC_CODEL, QDISC_FQ, QDISC_FQ_CODEL, QDISC_RED };
+
+struct qdisc_config {
+    enum qdisc_type type;
+    bool ecn;                   // Mark ECT packets rather than drop them
+
+    // CoDel, alone or per fq_codel queue.
+    double target;
+    double interval;
+
+    // fq and fq_codel hash flows into buckets, served by deficit round
+    // robin with quantum packets per turn.
+    unsigned long buckets;
+    unsigned long quantum;
+
+    // RED's thresholds on the average queue are fractions of the
+    // buffer, with drop or mark probability rising from 0 at red_min to
+    // red_prob at red_max.
+    double red_min;
+    double red_max;
+    double red_prob;
+    double red_weight;
+};
+
+// As Linux's defaults, except that RED and CoDel mark by default too.
+#define QDISC_CONFIG_INIT {                     \
+        .type = QDISC_DROPTAIL,                 \
+        .ecn = true,                            \
+        .target = 5e-3,                         \
+        .interval = 100e-3,                     \
+        .buckets = 1024,                        \
+        .quantum = 1,                           \
+        .red_min = 0.25,                        \
+        .red_max = 0.75,                        \
+        .red_prob = 0.1,                        \
+        .red_weight = 0.002,                    \
+    }
+
+
+// RFC 8289's state for one queue.
+struct codel {
+    double first_above_time;    // 0 until the sojourn time goes above target
+    double drop_next;
+    unsigned long count;
+    unsigned long last_count;
+    bool dropping;
+};
+
+struct fq_bucket {
+    struct timed_buffer packets;
+    struct codel codel;
+    long deficit;
+    size_t next;                // In new_flows or old_flows
+    bool listed;
+};
+
+// A bucket list for fq_codel, linked through fq_bucket.next.
+struct fq_list {
+    size_t head;
+    size_t tail;
+};
+
+struct qdisc {
+    const struct qdisc_config *cfg;
+    size_t length;
+
+    // Everything but fq and fq_codel, with packets timed by when they
+    // arrived.
+    struct timed_buffer fifo;
+    struct codel codel;
+
+    struct fq_bucket *buckets;
+    struct fq_list new_flows;
+    struct fq_list old_flows;
+
+    double red_avg;
+    double idle_since;          // NAN while there is a backlog
+    unsigned long red_count;    // Packets since the last drop or mark
+    struct drand48_data rng;
+};
+
+
+void qdisc_init(struct qdisc *q, const struct qdisc_config *cfg, long seed);
+
+// Queues a packet, unless the queue already holds limit packets. Drops
+// go to dropped, which may take any queued packet under fq_codel.
+// tx_time is how long the link takes to send a packet.
+void qdisc_enqueue(struct qdisc *q, const struct packet *packet, double time,
+                   size_t limit, double tx_time, struct packet_buffer *dropped);
+
+// Takes the next packet to send, if any. AQM drops on the way go to
+// dropped.
+bool qdisc_dequeue(struct qdisc *q, double time, struct packet *packet,
+                   struct packet_buffer *dropped);
+
+void qdisc_free(struct qdisc *q);
+
+
+
+#endif /* _QDISC_H_ */
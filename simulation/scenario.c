@@ -0,0 +1,890 @@
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "scenario.h"
+
+
+#define MAX_LINE 1024
+#define DELIMS " \t\r\n"
+
+
+void scenario_init(struct scenario *scn)
+{
+    scn->num_flows = 1;
+    scn->mss = 1448;
+    scn->runtime = 60;
+    scn->report_interval = 0;
+
+    scn->buffer_bdps = 1;
+    scn->max_rtt = 0;
+
+    scn->rates = malloc(sizeof(struct rate_step));
+    scn->rates[0].time = 0;
+    scn->rates[0].rate = 10.0*GBPS;
+    scn->num_rates = 1;
+
+    scn->loss_model = LOSS_BERNOULLI;
+    scn->loss_prob = 0;
+    scn->loss_recover_prob = 1;
+
+    scn->ecn_threshold = 0;
+
+    scn->default_flow.rtt = 30e-3;
+    scn->default_flow.start_time = NAN;
+    scn->default_flow.stop_time = INFINITY;
+    scn->default_flow.app_rate = 0;
+    scn->default_flow.on_time = INFINITY;
+    scn->default_flow.off_time = 0;
+    scn->default_flow.pacing = false;
+    scn->default_flow.cc = CC_DAVIS;
+    scn->default_flow.route[0] = 0;
+    scn->default_flow.route_len = 1;
+    scn->default_flow.base_rtt = 0;
+    davis_params_init(&scn->default_flow.davis);
+
+    scn->flows = malloc(sizeof(struct flow_config));
+    scn->flows[0] = scn->default_flow;
+
+    scn->num_links = 1;
+    scn->default_link.rate = 0;
+    scn->default_link.capacity = NULL;
+    scn->default_link.delay = 0;
+    scn->default_link.buffer_bdps = NAN;
+    scn->default_link.max_rtt = 0;
+    scn->default_link.qdisc = (struct qdisc_config) QDISC_CONFIG_INIT;
+
+    scn->links = malloc(sizeof(struct link_config));
+    scn->links[0] = scn->default_link;
+
+    scn->dir = NULL;
+}
+
+
+void scenario_copy(struct scenario *dst, const struct scenario *src)
+{
+    *dst = *src;
+
+    dst->rates = malloc(src->num_rates*sizeof(struct rate_step));
+    memcpy(dst->rates, src->rates, src->num_rates*sizeof(struct rate_step));
+
+    dst->flows = malloc(src->num_flows*sizeof(struct flow_config));
+    memcpy(dst->flows, src->flows, src->num_flows*sizeof(struct flow_config));
+
+    dst->links = malloc(src->num_links*sizeof(struct link_config));
+    memcpy(dst->links, src->links, src->num_links*sizeof(struct link_config));
+
+    capacity_trace_get(dst->default_link.capacity);
+    for (size_t l = 0; l < dst->num_links; l++)
+        capacity_trace_get(dst->links[l].capacity);
+}
+
+
+void scenario_free(struct scenario *scn)
+{
+    capacity_trace_put(scn->default_link.capacity);
+    for (size_t l = 0; l < scn->num_links; l++)
+        capacity_trace_put(scn->links[l].capacity);
+
+    free(scn->rates);
+    free(scn->flows);
+    free(scn->links);
+
+    scn->rates = NULL;
+    scn->flows = NULL;
+    scn->links = NULL;
+    scn->num_links = 0;
+    scn->default_link.capacity = NULL;
+}
+
+
+static bool parse_double(const char *str, double *x, const char **suffix)
+{
+    char *end;
+
+    *x = strtod(str, &end);
+    *suffix = end;
+
+    return end != str && *x >= 0;
+}
+
+
+static bool parse_time(const char *str, double *time)
+{
+    const char *suffix;
+
+    if (!parse_double(str, time, &suffix))
+        return false;
+
+    if (*suffix == '\0' || strcmp(suffix, "s") == 0)
+        return true;
+    else if (strcmp(suffix, "ms") == 0)
+        *time *= 1e-3;
+    else if (strcmp(suffix, "us") == 0)
+        *time *= 1e-6;
+    else
+        return false;
+
+    return true;
+}
+
+
+// Rates are in bytes/s, or use the same suffixes as
+// tests/netem_setup.py, so 10gbits == 10*GBPS.
+static bool parse_rate(const char *str, double *rate)
+{
+    const char *suffix;
+    const char *scales = "kmgt";
+    const char *scale;
+
+    if (!parse_double(str, rate, &suffix))
+        return false;
+
+    if (*suffix == '\0')
+        return true;
+
+    if ((scale = strchr(scales, *suffix)) != NULL) {
+        *rate *= pow(1024, scale - scales + 1);
+        suffix++;
+    } else if ((scale = strchr("KMGT", *suffix)) != NULL) {
+        *rate *= pow(1000, scale - "KMGT" + 1);
+        suffix++;
+    }
+
+    if (strcmp(suffix, "bits") == 0)
+        *rate /= 8;
+    else if (strcmp(suffix, "bytes") != 0)
+        return false;
+
+    return true;
+}
+
+
+static bool parse_prob(const char *str, double *prob)
+{
+    const char *suffix;
+
+    return parse_double(str, prob, &suffix) && *suffix == '\0' && *prob <= 1;
+}
+
+
+static bool parse_index(const char *str, unsigned long *index)
+{
+    char *end;
+
+    *index = strtoul(str, &end, 10);
+
+    return end != str && *end == '\0';
+}
+
+
+static bool parse_count(const char *str, unsigned long *count)
+{
+    return parse_index(str, count) && *count > 0;
+}
+
+
+// An index, or an inclusive range of them such as 2-5.
+static bool parse_range(const char *str, unsigned long *first,
+                        unsigned long *last)
+{
+    char buf[MAX_LINE];
+    char *dash;
+
+    strncpy(buf, str, MAX_LINE - 1);
+    buf[MAX_LINE - 1] = '\0';
+
+    if ((dash = strchr(buf, '-')) == NULL) {
+        if (!parse_index(buf, first))
+            return false;
+
+        *last = *first;
+        return true;
+    }
+
+    *dash = '\0';
+
+    return parse_index(buf, first) && parse_index(dash + 1, last);
+}
+
+
+// Which of num flows or links a line applies to: *, an index or a
+// range. Returns false if any of them is out of range.
+static bool parse_ids(const char *str, size_t num, bool *all,
+                      unsigned long *first, unsigned long *last)
+{
+    *all = strcmp(str, "*") == 0;
+
+    if (*all) {
+        *first = 0;
+        *last = num - 1;
+        return true;
+    }
+
+    return parse_range(str, first, last) && *first <= *last && *last < num;
+}
+
+
+// Links separated by colons, where each may be a range going either
+// way, such as 0-4 or 4-0 or 0:2:3.
+static bool parse_route(char *str, struct flow_config *flow)
+{
+    char *saveptr;
+    char *hop;
+    size_t len = 0;
+
+    for (hop = strtok_r(str, ":", &saveptr); hop != NULL;
+         hop = strtok_r(NULL, ":", &saveptr)) {
+        unsigned long first, last;
+        long step;
+
+        if (!parse_range(hop, &first, &last))
+            return false;
+
+        step = first <= last ? 1 : -1;
+
+        for (unsigned long link = first; ; link += step) {
+            if (len == MAX_HOPS)
+                return false;
+
+            flow->route[len++] = link;
+
+            if (link == last)
+                break;
+        }
+    }
+
+    if (len == 0)
+        return false;
+
+    flow->route_len = len;
+    return true;
+}
+
+
+static bool parse_u32(const char *str, u32 *x)
+{
+    unsigned long count;
+
+    if (!parse_index(str, &count) || count > U32_MAX)
+        return false;
+
+    *x = count;
+    return true;
+}
+
+
+// Davis tunables are given as fractions and stored scaled by
+// DAVIS_ONE, as the kernel module takes them.
+static bool parse_fixed(const char *str, u32 *x)
+{
+    const char *suffix;
+    double frac;
+
+    if (!parse_double(str, &frac, &suffix) || *suffix != '\0')
+        return false;
+
+    *x = llround(frac*DAVIS_ONE);
+    return true;
+}
+
+
+static bool parse_switch(const char *str, bool *x)
+{
+    if (strcmp(str, "on") == 0)
+        *x = true;
+    else if (strcmp(str, "off") == 0)
+        *x = false;
+    else
+        return false;
+
+    return true;
+}
+
+
+static void set_num_flows(struct scenario *scn, size_t num_flows)
+{
+    scn->flows = realloc(scn->flows, num_flows*sizeof(struct flow_config));
+
+    for (size_t i = scn->num_flows; i < num_flows; i++)
+        scn->flows[i] = scn->default_flow;
+
+    scn->num_flows = num_flows;
+}
+
+
+static void set_num_links(struct scenario *scn, size_t num_links)
+{
+    for (size_t i = num_links; i < scn->num_links; i++)
+        capacity_trace_put(scn->links[i].capacity);
+
+    scn->links = realloc(scn->links, num_links*sizeof(struct link_config));
+
+    for (size_t i = scn->num_links; i < num_links; i++) {
+        scn->links[i] = scn->default_link;
+        capacity_trace_get(scn->links[i].capacity);
+    }
+
+    scn->num_links = num_links;
+}
+
+
+static void set_rate(struct scenario *scn, double time, double rate)
+{
+    size_t i = 0;
+
+    while (i < scn->num_rates && scn->rates[i].time < time)
+        i++;
+
+    if (i == scn->num_rates || scn->rates[i].time != time) {
+        scn->rates = realloc(scn->rates,
+                             (scn->num_rates + 1)*sizeof(struct rate_step));
+        memmove(&scn->rates[i + 1], &scn->rates[i],
+                (scn->num_rates - i)*sizeof(struct rate_step));
+        scn->num_rates++;
+    }
+
+    scn->rates[i].time = time;
+    scn->rates[i].rate = rate;
+}
+
+
+static bool parse_flow_option(struct flow_config *flow, char *option)
+{
+    struct davis_params *davis = &flow->davis;
+    char *value = strchr(option, '=');
+    double time;
+    bool ecn;
+
+    if (value == NULL)
+        return false;
+
+    *value++ = '\0';
+
+    if (strcmp(option, "rtt") == 0)
+        return parse_time(value, &flow->rtt) && flow->rtt > 0;
+    else if (strcmp(option, "start") == 0)
+        return parse_time(value, &flow->start_time);
+    else if (strcmp(option, "stop") == 0)
+        return parse_time(value, &flow->stop_time);
+    else if (strcmp(option, "app_rate") == 0)
+        return parse_rate(value, &flow->app_rate);
+    else if (strcmp(option, "on") == 0)
+        return parse_time(value, &flow->on_time) && flow->on_time > 0;
+    else if (strcmp(option, "off") == 0)
+        return parse_time(value, &flow->off_time) && flow->off_time >= 0;
+    else if (strcmp(option, "pacing") == 0)
+        return parse_switch(value, &flow->pacing);
+    else if (strcmp(option, "cc") == 0)
+        return cc_parse(value, &flow->cc);
+    else if (strcmp(option, "reactivity") == 0)
+        return parse_fixed(value, &davis->reactivity);
+    else if (strcmp(option, "sensitivity") == 0)
+        return parse_fixed(value, &davis->sensitivity);
+    else if (strcmp(option, "stable_rtts_min") == 0)
+        return parse_u32(value, &davis->stable_rtts_min) && davis->stable_rtts_min > 0;
+    else if (strcmp(option, "stable_rtts_max") == 0)
+        return parse_u32(value, &davis->stable_rtts_max) && davis->stable_rtts_max > 0;
+    else if (strcmp(option, "min_gain_cwnd") == 0)
+        return parse_u32(value, &davis->min_gain_cwnd);
+    else if (strcmp(option, "rtt_timeout") == 0)
+        return parse_time(value, &time) && (davis->rtt_timeout_ms = llround(time*1e3)) > 0;
+    else if (strcmp(option, "ecn") == 0) {
+        ecn = davis->ecn;
+        if (!parse_switch(value, &ecn))
+            return false;
+        davis->ecn = ecn;
+        return true;
+    } else if (strcmp(option, "route") == 0) {
+        return parse_route(value, flow);
+    } else if (strcmp(option, "startup") == 0) {
+        if (strcmp(value, "classic") == 0)
+            davis->startup = DAVIS_STARTUP_CLASSIC;
+        else if (strcmp(value, "fast") == 0)
+            davis->startup = DAVIS_STARTUP_FAST;
+        else
+            return false;
+        return true;
+    } else if (strcmp(option, "pacing_gain_slow_start") == 0)
+        return parse_fixed(value, &davis->pacing_gain_slow_start);
+    else if (strcmp(option, "pacing_gain_drain") == 0)
+        return parse_fixed(value, &davis->pacing_gain_drain);
+    else if (strcmp(option, "pacing_gain_stable") == 0)
+        return parse_fixed(value, &davis->pacing_gain_stable);
+    else if (strcmp(option, "pacing_gain_probe") == 0)
+        return parse_fixed(value, &davis->pacing_gain_probe);
+    else
+        return false;
+}
+
+
+static bool parse_flow(struct scenario *scn, char **saveptr)
+{
+    char *id = strtok_r(NULL, DELIMS, saveptr);
+    char *option;
+    unsigned long first, last;
+    bool all;
+
+    if (id == NULL || !parse_ids(id, scn->num_flows, &all, &first, &last))
+        return false;
+
+    // Options are parsed in place, so each flow gets a fresh copy.
+    while ((option = strtok_r(NULL, DELIMS, saveptr)) != NULL) {
+        char copy[MAX_LINE];
+
+        strncpy(copy, option, MAX_LINE - 1);
+        copy[MAX_LINE - 1] = '\0';
+
+        if (all && !parse_flow_option(&scn->default_flow, copy))
+            return false;
+
+        for (size_t i = first; i <= last; i++) {
+            strcpy(copy, option);
+
+            if (!parse_flow_option(&scn->flows[i], copy))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool parse_qdisc_type(const char *str, enum qdisc_type *type)
+{
+    if (strcmp(str, "droptail") == 0)
+        *type = QDISC_DROPTAIL;
+    else if (strcmp(str, "codel") == 0)
+        *type = QDISC_CODEL;
+    else if (strcmp(str, "fq") == 0)
+        *type = QDISC_FQ;
+    else if (strcmp(str, "fq_codel") == 0)
+        *type = QDISC_FQ_CODEL;
+    else if (strcmp(str, "red") == 0)
+        *type = QDISC_RED;
+    else
+        return false;
+
+    return true;
+}
+
+
+// A capacity trace file, relative to dir unless it is absolute, or
+// "none" for a fixed rate.
+static bool parse_capacity(const char *dir, const char *path,
+                           struct capacity_trace **capacity)
+{
+    struct capacity_trace *trace = NULL;
+    char full[PATH_MAX];
+
+    if (strcmp(path, "none") != 0) {
+        if (dir != NULL && path[0] != '/') {
+            snprintf(full, sizeof(full), "%s/%s", dir, path);
+            path = full;
+        }
+
+        if ((trace = capacity_trace_open(path)) == NULL)
+            return false;
+    }
+
+    capacity_trace_put(*capacity);
+    *capacity = trace;
+
+    return true;
+}
+
+
+static bool parse_link_option(const struct scenario *scn,
+                              struct link_config *link, char *option)
+{
+    struct qdisc_config *qdisc = &link->qdisc;
+    char *value = strchr(option, '=');
+    const char *suffix;
+
+    if (value == NULL)
+        return false;
+
+    *value++ = '\0';
+
+    if (strcmp(option, "rate") == 0)
+        return parse_rate(value, &link->rate) && link->rate > 0;
+    else if (strcmp(option, "delay") == 0)
+        return parse_time(value, &link->delay);
+    else if (strcmp(option, "buffer") == 0)
+        return parse_double(value, &link->buffer_bdps, &suffix) && *suffix == '\0';
+    else if (strcmp(option, "trace") == 0)
+        return parse_capacity(scn->dir, value, &link->capacity);
+    else if (strcmp(option, "qdisc") == 0)
+        return parse_qdisc_type(value, &qdisc->type);
+    else if (strcmp(option, "mark") == 0)
+        return parse_switch(value, &qdisc->ecn);
+    else if (strcmp(option, "target") == 0)
+        return parse_time(value, &qdisc->target) && qdisc->target > 0;
+    else if (strcmp(option, "interval") == 0)
+        return parse_time(value, &qdisc->interval) && qdisc->interval > 0;
+    else if (strcmp(option, "buckets") == 0)
+        return parse_count(value, &qdisc->buckets);
+    else if (strcmp(option, "quantum") == 0)
+        return parse_count(value, &qdisc->quantum);
+    else if (strcmp(option, "red_min") == 0)
+        return parse_prob(value, &qdisc->red_min);
+    else if (strcmp(option, "red_max") == 0)
+        return parse_prob(value, &qdisc->red_max);
+    else if (strcmp(option, "red_prob") == 0)
+        return parse_prob(value, &qdisc->red_prob);
+    else
+        return false;
+}
+
+
+static bool parse_link(struct scenario *scn, char **saveptr)
+{
+    char *id = strtok_r(NULL, DELIMS, saveptr);
+    char *option;
+    unsigned long first, last;
+    bool all;
+
+    if (id == NULL || !parse_ids(id, scn->num_links, &all, &first, &last))
+        return false;
+
+    while ((option = strtok_r(NULL, DELIMS, saveptr)) != NULL) {
+        char copy[MAX_LINE];
+
+        strncpy(copy, option, MAX_LINE - 1);
+        copy[MAX_LINE - 1] = '\0';
+
+        if (all && !parse_link_option(scn, &scn->default_link, copy))
+            return false;
+
+        for (size_t i = first; i <= last; i++) {
+            strcpy(copy, option);
+
+            if (!parse_link_option(scn, &scn->links[i], copy))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool parse_loss(struct scenario *scn, char **saveptr)
+{
+    char *model = strtok_r(NULL, DELIMS, saveptr);
+    char *prob = strtok_r(NULL, DELIMS, saveptr);
+    char *recover = strtok_r(NULL, DELIMS, saveptr);
+
+    if (model == NULL)
+        return false;
+
+    if (strcmp(model, "bernoulli") == 0 && prob != NULL && recover == NULL) {
+        scn->loss_model = LOSS_BERNOULLI;
+        return parse_prob(prob, &scn->loss_prob);
+    } else if (strcmp(model, "gilbert") == 0 && recover != NULL) {
+        scn->loss_model = LOSS_GILBERT;
+        return parse_prob(prob, &scn->loss_prob)
+            && parse_prob(recover, &scn->loss_recover_prob);
+    } else if (prob == NULL) {
+        scn->loss_model = LOSS_BERNOULLI;
+        return parse_prob(model, &scn->loss_prob);
+    } else {
+        return false;
+    }
+}
+
+
+bool scenario_parse_line(struct scenario *scn, const char *line,
+                         const char *source, size_t lineno)
+{
+    char buf[MAX_LINE];
+    char *saveptr;
+    char *key, *arg, *extra;
+    bool ok;
+
+    strncpy(buf, line, MAX_LINE - 1);
+    buf[MAX_LINE - 1] = '\0';
+
+    if ((key = strchr(buf, '#')) != NULL)
+        *key = '\0';
+
+    key = strtok_r(buf, DELIMS, &saveptr);
+
+    if (key == NULL)
+        return true;
+
+    if (strcmp(key, "flow") == 0) {
+        ok = parse_flow(scn, &saveptr);
+    } else if (strcmp(key, "link") == 0) {
+        ok = parse_link(scn, &saveptr);
+    } else if (strcmp(key, "loss") == 0) {
+        ok = parse_loss(scn, &saveptr);
+    } else if (strcmp(key, "rate") == 0) {
+        char *rate;
+        double time, r;
+
+        arg = strtok_r(NULL, DELIMS, &saveptr);
+        rate = strtok_r(NULL, DELIMS, &saveptr);
+        extra = strtok_r(NULL, DELIMS, &saveptr);
+
+        // "rate R" is shorthand for a constant rate.
+        if (rate == NULL && arg != NULL) {
+            ok = parse_rate(arg, &r) && r > 0;
+
+            if (ok) {
+                scn->num_rates = 0;
+                set_rate(scn, 0, r);
+            }
+        } else {
+            ok = arg != NULL && extra == NULL && parse_time(arg, &time)
+                && parse_rate(rate, &r) && r > 0;
+
+            if (ok)
+                set_rate(scn, time, r);
+        }
+    } else {
+        arg = strtok_r(NULL, DELIMS, &saveptr);
+        extra = strtok_r(NULL, DELIMS, &saveptr);
+        ok = arg != NULL && extra == NULL;
+
+        if (!ok) {
+        } else if (strcmp(key, "runtime") == 0) {
+            ok = parse_time(arg, &scn->runtime) && scn->runtime > 0;
+        } else if (strcmp(key, "report") == 0) {
+            ok = parse_time(arg, &scn->report_interval);
+        } else if (strcmp(key, "mss") == 0) {
+            ok = parse_count(arg, &scn->mss);
+        } else if (strcmp(key, "buffer") == 0) {
+            const char *suffix;
+            ok = parse_double(arg, &scn->buffer_bdps, &suffix) && *suffix == '\0';
+        } else if (strcmp(key, "ecn") == 0) {
+            ok = parse_index(arg, &scn->ecn_threshold);
+        } else if (strcmp(key, "flows") == 0) {
+            unsigned long num_flows;
+            ok = parse_count(arg, &num_flows);
+
+            if (ok)
+                set_num_flows(scn, num_flows);
+        } else if (strcmp(key, "links") == 0) {
+            unsigned long num_links;
+            ok = parse_count(arg, &num_links);
+
+            if (ok)
+                set_num_links(scn, num_links);
+        } else {
+            fprintf(stderr, "%s:%zu: unknown setting \"%s\"\n",
+                    source, lineno, key);
+            return false;
+        }
+    }
+
+    if (!ok)
+        fprintf(stderr, "%s:%zu: bad \"%s\" setting\n", source, lineno, key);
+
+    return ok;
+}
+
+
+bool scenario_load(struct scenario *scn, const char *path)
+{
+    char line[MAX_LINE];
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    size_t lineno = 0;
+    bool ok = true;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    // A file in the working directory needs no prefix.
+    if (slash != NULL) {
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+        scn->dir = dir;
+    }
+
+    while (ok && fgets(line, MAX_LINE, file) != NULL)
+        ok = scenario_parse_line(scn, line, path, ++lineno);
+
+    fclose(file);
+    scn->dir = NULL;
+
+    return ok;
+}
+
+
+bool scenario_finalize(struct scenario *scn)
+{
+    double all_by = 10;
+
+    scn->max_rtt = 0;
+
+    if (scn->num_flows > MAX_FLOWS) {
+        fprintf(stderr, "At most %d flows are supported\n", MAX_FLOWS);
+        return false;
+    }
+
+    for (size_t l = 0; l < scn->num_links; l++)
+        scn->links[l].max_rtt = 0;
+
+    for (size_t i = 0; i < scn->num_flows; i++) {
+        struct flow_config *flow = &scn->flows[i];
+
+        if (isnan(flow->start_time))
+            flow->start_time = i*all_by/(scn->num_flows + 1);
+
+        flow->base_rtt = flow->rtt;
+
+        for (size_t h = 0; h < flow->route_len; h++) {
+            if (flow->route[h] >= scn->num_links) {
+                fprintf(stderr, "Flow %zu's route crosses link %u of %zu\n",
+                        i, flow->route[h], scn->num_links);
+                return false;
+            }
+
+            const struct link_config *link = &scn->links[flow->route[h]];
+
+            flow->base_rtt += link->delay;
+            if (link->capacity != NULL)
+                flow->base_rtt += link->capacity->min_delay;
+        }
+
+        for (size_t h = 0; h < flow->route_len; h++) {
+            struct link_config *link = &scn->links[flow->route[h]];
+
+            if (flow->base_rtt > link->max_rtt)
+                link->max_rtt = flow->base_rtt;
+        }
+
+        if (flow->base_rtt > scn->max_rtt)
+            scn->max_rtt = flow->base_rtt;
+
+        if (!davis_params_valid(&flow->davis)) {
+            fprintf(stderr, "Invalid Davis parameters for flow %zu\n", i);
+            return false;
+        }
+    }
+
+    for (size_t l = 0; l < scn->num_links; l++) {
+        const struct qdisc_config *qdisc = &scn->links[l].qdisc;
+
+        if (qdisc->type == QDISC_RED && qdisc->red_min >= qdisc->red_max) {
+            fprintf(stderr, "Link %zu's red_min must be under red_max\n", l);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void scenario_usage(FILE *out)
+{
+    fprintf(out,
+            "Scenario lines (one per line, # starts a comment):\n"
+            "  runtime TIME        Simulated time (default 60s)\n"
+            "  mss BYTES           Packet size (default 1448)\n"
+            "  flows N             Number of flows (default 1)\n"
+            "  links N             Number of links (default 1)\n"
+            "  buffer BDPS         Link buffers in BDPs of their longest RTT (default 1)\n"
+            "  report TIME         Logging interval (default runtime/1000)\n"
+            "  rate [TIME] RATE    Link rate from TIME on (default 10gbits)\n"
+            "  loss PROB           Drop packets at random with PROB\n"
+            "  loss gilbert P R    Bursty loss, enter the loss state with P, leave with R\n"
+            "  ecn PACKETS         CE mark ECN flows' packets above this queue length\n"
+            "  link ID|* OPTS...   Per-link options rate=RATE delay=TIME buffer=BDPS, where\n"
+            "                      ID may be a range such as 1-3, trace=FILE|none to\n"
+            "                      replay a Mahimahi or time,rate[,delay] CSV capacity\n"
+            "                      trace in place of rate, with buffers sized for its mean,\n"
+            "                      qdisc=droptail|codel|fq|fq_codel|red with mark=on|off\n"
+            "                      to mark ECN flows rather than drop, CoDel's target=TIME\n"
+            "                      interval=TIME, fq's buckets=N quantum=PACKETS,\n"
+            "                      and RED's red_min=X red_max=X (fractions of the buffer)\n"
+            "                      red_prob=X\n"
+            "  flow ID|* OPTS...   Per-flow options rtt=TIME start=TIME stop=TIME app_rate=RATE\n"
+            "                      route=LINKS (such as 0-4 or 0:2, default 0), where rtt\n"
+            "                      excludes the route's link delays,\n"
+            "                      cc=davis|reno|cubic|bbr (BBR always paces),\n"
+            "                      and Davis tunables reactivity=X sensitivity=X (fractions)\n"
+            "                      stable_rtts_min=N stable_rtts_max=N min_gain_cwnd=N\n"
+            "                      rtt_timeout=TIME, on=TIME off=TIME to alternate between\n"
+            "                      sending and idling, ecn=on|off, startup=classic|fast,\n"
+            "                      and pacing=on|off with\n"
+            "                      per-mode gains pacing_gain_slow_start=X pacing_gain_drain=X\n"
+            "                      pacing_gain_stable=X pacing_gain_probe=X\n"
+            "TIME takes an s, ms or us suffix. RATE is in bytes/s or takes a suffix\n"
+            "such as 10gbits or 100Mbytes (lowercase scales are powers of 1024).\n");
+}
+
+
+double scenario_rate(const struct scenario *scn, double time)
+{
+    size_t i = scn->num_rates;
+
+    while (i > 1 && scn->rates[i - 1].time > time)
+        i--;
+
+    return scn->rates[i - 1].rate;
+}
+
+
+double scenario_app_rate(const struct scenario *scn, double time,
+                         size_t flow)
+{
+    if (scn->flows[flow].app_rate > 0)
+        return scn->flows[flow].app_rate;
+    else
+        return 2*scenario_link_rate(scn, time, scn->flows[flow].route[0]);
+}
+
+
+double scenario_app_next(const struct scenario *scn, double time,
+                         size_t flow)
+{
+    const struct flow_config *cfg = &scn->flows[flow];
+    double period = cfg->on_time + cfg->off_time;
+    double phase;
+
+    if (cfg->off_time <= 0 || isinf(cfg->on_time))
+        return time;
+
+    phase = fmod(time - cfg->start_time, period);
+
+    return phase < cfg->on_time ? time : time + period - phase;
+}
+
+
+double scenario_link_rate(const struct scenario *scn, double time,
+                          size_t link)
+{
+    // What a trace averages, as sim_run() replays the trace itself.
+    if (scn->links[link].capacity != NULL)
+        return scn->links[link].capacity->mean_rate;
+    else if (scn->links[link].rate > 0)
+        return scn->links[link].rate;
+    else
+        return scenario_rate(scn, time);
+}
+
+
+unsigned long scenario_buf_size(const struct scenario *scn, double time,
+                                size_t link)
+{
+    const struct link_config *cfg = &scn->links[link];
+    double bdps = isnan(cfg->buffer_bdps) ? scn->buffer_bdps : cfg->buffer_bdps;
+
+    return bdps*scenario_link_rate(scn, time, link)*cfg->max_rtt/scn->mss;
+}
+
+
+double scenario_report_interval(const struct scenario *scn)
+{
+    if (scn->report_interval > 0)
+        return scn->report_interval;
+    else if (scn->num_flows > 16)
+        return scn->runtime/100;
+    else
+        return scn->runtime/1000;
+}
@@ -0,0 +1,139 @@
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "capacity.h"
+#include "cc.h"
+#include "qdisc.h"
+
+#ifndef _SCENARIO_H_
+#define _SCENARIO_H_
+
+
+#define MBPS 131072
+#define GBPS 134217728
+
+// Longest route a flow may take, and most flows a scenario may have, as
+// packets only have room for so many bits of each.
+#define MAX_HOPS 16
+#define MAX_FLOWS (1 << 24)
+
+
+enum loss_model { LOSS_BERNOULLI, LOSS_GILBERT };
+
+struct flow_config {
+    double rtt;             // Excluding the delays of links on the route
+    double start_time;      // NAN spreads flows over the first 10s
+    double stop_time;
+    double app_rate;        // 0 sends at twice the bottleneck rate
+    double on_time;         // The application alternates between having
+    double off_time;        // data for on_time and none for off_time
+    bool pacing;
+    enum cc_algorithm cc;
+
+    // Links crossed in order, by index into the scenario's links.
+    unsigned int route[MAX_HOPS];
+    size_t route_len;
+    double base_rtt;        // rtt plus the route's delays, set by
+                            // scenario_finalize
+
+    struct davis_params davis;
+};
+
+// A queue served at rate, followed by delay to the next hop (or the
+// receiver).
+struct link_config {
+    double rate;            // 0 follows the scenario's rate steps
+    struct capacity_trace *capacity;    // Replaces rate unless NULL
+    double delay;
+    double buffer_bdps;     // NAN uses the scenario's buffer
+    double max_rtt;         // Longest base RTT of the flows crossing it,
+                            // set by scenario_finalize
+
+    struct qdisc_config qdisc;
+};
+
+// Bottleneck rate from time onwards.
+struct rate_step {
+    double time;
+    double rate;
+};
+
+struct scenario {
+    size_t num_flows;
+    unsigned long mss;
+    double runtime;
+    double report_interval; // 0 picks one from runtime and num_flows
+
+    double buffer_bdps;     // Relative to each link's longest base RTT
+    double max_rtt;         // Over all flows, set by scenario_finalize
+
+    struct rate_step *rates;
+    size_t num_rates;
+
+    // Bernoulli drops each packet with loss_prob. Gilbert enters a
+    // bursty state that drops every packet with loss_prob and leaves
+    // it with loss_recover_prob.
+    enum loss_model loss_model;
+    double loss_prob;
+    double loss_recover_prob;
+
+    // Packets of ECN flows leave the bottleneck CE marked when the
+    // queue holds more than this many, as a DCTCP switch marks them.
+    // 0 turns marking off.
+    unsigned long ecn_threshold;
+
+    struct flow_config default_flow;
+    struct flow_config *flows;
+
+    size_t num_links;
+    struct link_config default_link;
+    struct link_config *links;
+
+    // Of the file scenario_load() is reading, which relative trace=
+    // paths are taken from. NULL otherwise, for the working directory.
+    const char *dir;
+};
+
+
+void scenario_init(struct scenario *scn);
+
+void scenario_copy(struct scenario *dst, const struct scenario *src);
+
+void scenario_free(struct scenario *scn);
+
+// Apply a single scenario line, such as "flow 0 rtt=20ms". Returns
+// false and prints an error if the line is malformed.
+bool scenario_parse_line(struct scenario *scn, const char *line,
+                         const char *source, size_t lineno);
+
+bool scenario_load(struct scenario *scn, const char *path);
+
+// Resolve defaults that depend on the whole scenario and check the
+// result. Call once all lines have been applied.
+bool scenario_finalize(struct scenario *scn);
+
+void scenario_usage(FILE *out);
+
+
+double scenario_rate(const struct scenario *scn, double time);
+
+double scenario_link_rate(const struct scenario *scn, double time,
+                          size_t link);
+
+double scenario_app_rate(const struct scenario *scn, double time,
+                         size_t flow);
+
+// Earliest time from time on that the flow's application has data.
+double scenario_app_next(const struct scenario *scn, double time,
+                         size_t flow);
+
+unsigned long scenario_buf_size(const struct scenario *scn, double time,
+                                size_t link);
+
+double scenario_report_interval(const struct scenario *scn);
+
+
+
+#endif /* _SCENARIO_H_ */
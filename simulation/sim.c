@@ -0,0 +1,553 @@
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "cc.h"
+#include "event.h"
+#include "packet.h"
+#include "qdisc.h"
+#include "sim.h"
+
+
+// RTT samples are binned with RTT_HIST_SUB bins per power of two
+// (about 1% resolution) from 2^RTT_HIST_MIN_EXP seconds up.
+#define RTT_HIST_MIN_EXP -24
+#define RTT_HIST_SUB 64
+#define RTT_HIST_BINS (40*RTT_HIST_SUB)
+
+// A paced flow may send this many packets back to back after idling,
+// like fq's default quantum.
+#define PACING_BURST 2
+
+struct rtt_hist {
+    unsigned long counts[RTT_HIST_BINS];
+    unsigned long total;
+};
+
+struct flow {
+    struct cc cc;
+    struct packet_buffer network;
+
+    double next_send_time;      // Application rate limit
+    double pace_time;           // Pacing limit, a token bucket's virtual clock
+    bool send_pending;
+
+    unsigned long inflight;
+    unsigned long bytes_sent;
+    unsigned long pkts_delivered;
+    // Packets sent before the delivered count passes app_limited were
+    // sent while the application was short of data, as in tcp_rate.c.
+    unsigned long app_limited;
+    bool app_idle;
+    unsigned long losses;
+    // Like fast recovery, losses up to a round trip after the first are
+    // one loss episode.
+    double recovery_end;
+    double rtt;
+};
+
+struct link {
+    struct qdisc qdisc;
+    struct packet in_service;
+    bool busy;
+    size_t peak;                  // Queued and in service
+    struct capacity_cursor capacity;
+    struct timed_buffer pipe;     // Served, on the way to the next hop
+    double pipe_last;             // When the pipe's last packet leaves
+
+    double util_start;
+    unsigned long util_packets;
+    double time_to_90;
+};
+
+
+static void schedule_send(const struct scenario *scn,
+                          struct event_queue *events, struct flow *flows,
+                          double now, size_t flow)
+{
+    struct flow *f = &flows[flow];
+    double time = fmax(f->next_send_time, f->pace_time);
+
+    if (f->send_pending || f->inflight >= f->cc.cwnd)
+        return;
+
+    if (time < now)
+        time = now;
+
+    if (time < scn->flows[flow].start_time)
+        time = scn->flows[flow].start_time;
+
+    if (time >= scn->flows[flow].stop_time)
+        return;
+
+    event_queue_push(events, time, SEND, flow);
+    f->send_pending = true;
+}
+
+
+// Sets when the application next has a packet for the flow, after one
+// at time. app_idle notes when it runs dry until the next on period.
+static void app_next_send(const struct scenario *scn, struct flow *f,
+                          double time, size_t flow)
+{
+    double next_data = time + scn->mss/scenario_app_rate(scn, time, flow);
+
+    f->next_send_time = scenario_app_next(scn, next_data, flow);
+    f->app_idle = f->next_send_time > next_data;
+}
+
+
+// Charges one packet sent at time to the flow's pacing bucket. The
+// bucket refills at the current pacing rate and holds PACING_BURST
+// packets, so pace_time is when the next packet's tokens are in.
+static void pace_packet(struct flow *f, double time, unsigned long mss)
+{
+    double rate = f->cc.pacing_rate;
+
+    if (rate <= 0) {
+        f->pace_time = 0;
+        return;
+    }
+
+    f->pace_time = fmax(f->pace_time, time - (PACING_BURST - 1)*mss/rate);
+    f->pace_time += mss/rate;
+}
+
+
+// Starts sending the link's next packet, if its qdisc has one.
+static void link_serve(const struct scenario *scn, struct event_queue *events,
+                       struct link *links, struct packet_buffer *lost,
+                       double time, size_t link)
+{
+    struct link *l = &links[link];
+    double done;
+
+    l->busy = qdisc_dequeue(&l->qdisc, time, &l->in_service, lost);
+
+    if (!l->busy)
+        return;
+
+    if (scn->links[link].capacity != NULL)
+        done = capacity_send(&l->capacity, time, scn->mss);
+    else
+        done = time + scn->mss/scenario_link_rate(scn, time, link);
+
+    event_queue_push(events, done, DEPARTURE, link);
+}
+
+
+// Hands a packet to a link's qdisc, which may drop it or others.
+static void link_arrival(const struct scenario *scn, struct event_queue *events,
+                         struct link *links, struct packet_buffer *lost,
+                         double time, size_t link, const struct packet *packet)
+{
+    struct link *l = &links[link];
+    size_t buf = scenario_buf_size(scn, time, link);
+    double rate = scenario_link_rate(scn, time, link);
+
+    // The packet in service still takes up a buffer slot.
+    qdisc_enqueue(&l->qdisc, packet, time, buf > l->busy ? buf - l->busy : 0,
+                  scn->mss/rate, lost);
+
+    if (l->qdisc.length + l->busy > l->peak)
+        l->peak = l->qdisc.length + l->busy;
+
+    if (!l->busy)
+        link_serve(scn, events, links, lost, time, link);
+}
+
+
+static inline double uniform(struct drand48_data *rng)
+{
+    double x;
+
+    drand48_r(rng, &x);
+
+    return x;
+}
+
+
+static bool packet_lost(const struct scenario *scn,
+                        struct drand48_data *rng, bool *loss_burst)
+{
+    if (scn->loss_model == LOSS_BERNOULLI)
+        return scn->loss_prob > 0 && uniform(rng) < scn->loss_prob;
+
+    if (*loss_burst)
+        *loss_burst = uniform(rng) >= scn->loss_recover_prob;
+    else
+        *loss_burst = uniform(rng) < scn->loss_prob;
+
+    return *loss_burst;
+}
+
+
+static void rtt_hist_add(struct rtt_hist *hist, double rtt)
+{
+    int exp;
+    double frac = frexp(rtt, &exp);
+    long bin = (exp - RTT_HIST_MIN_EXP)*RTT_HIST_SUB;
+
+    bin += (long) ((2*frac - 1)*RTT_HIST_SUB);
+    bin = bin < 0 ? 0 : bin;
+    bin = bin >= RTT_HIST_BINS ? RTT_HIST_BINS - 1 : bin;
+
+    hist->counts[bin]++;
+    hist->total++;
+}
+
+
+static double rtt_hist_quantile(const struct rtt_hist *hist, double q)
+{
+    unsigned long target = q*hist->total;
+    unsigned long seen = 0;
+
+    if (hist->total == 0)
+        return 0;
+
+    for (long bin = 0; bin < RTT_HIST_BINS; bin++) {
+        seen += hist->counts[bin];
+
+        if (seen > target) {
+            long exp = bin/RTT_HIST_SUB + RTT_HIST_MIN_EXP;
+            double frac = (bin%RTT_HIST_SUB + 0.5)/RTT_HIST_SUB;
+
+            return ldexp((1 + frac)/2, exp);
+        }
+    }
+
+    return 0;
+}
+
+
+static void summarize(const struct scenario *scn, const struct flow *flows,
+                      const struct rtt_hist *hist, struct sim_result *result)
+{
+    double total = 0, sum_rate = 0, sum_rate_sqr = 0;
+    size_t active = 0;
+
+    result->losses = 0;
+
+    for (int a = 0; a < NUM_CC; a++)
+        result->share[a] = NAN;
+
+    for (size_t i = 0; i < scn->num_flows; i++) {
+        double start = scn->flows[i].start_time;
+        double stop = scn->flows[i].stop_time;
+        double bytes = (double) flows[i].pkts_delivered*scn->mss;
+        double *share = &result->share[scn->flows[i].cc];
+
+        stop = stop < scn->runtime ? stop : scn->runtime;
+        total += bytes;
+        *share = isnan(*share) ? bytes : *share + bytes;
+        result->losses += flows[i].losses;
+
+        if (stop > start) {
+            double rate = bytes/(stop - start);
+
+            sum_rate += rate;
+            sum_rate_sqr += rate*rate;
+            active++;
+        }
+    }
+
+    for (int a = 0; a < NUM_CC; a++)
+        result->share[a] /= total > 0 ? total : 1;
+
+    result->throughput = total/scn->runtime;
+    result->jain = sum_rate_sqr > 0 ? sum_rate*sum_rate/(active*sum_rate_sqr) : 0;
+    result->rtt_p50 = rtt_hist_quantile(hist, 0.5);
+    result->rtt_p99 = rtt_hist_quantile(hist, 0.99);
+}
+
+
+void sim_run(const struct scenario *scn, long seed, struct trace_writer *trace,
+             bool progress, struct sim_result *result)
+{
+    const double runtime = scn->runtime;
+    const unsigned long mss = scn->mss;
+    const double report_interval = scenario_report_interval(scn);
+
+    unsigned int last_perc = 0;
+    double last_print_time = 0;
+    double time = 0;
+
+    struct event_queue events = event_queue_empty;
+    struct event event;
+
+    struct flow *flows = calloc(scn->num_flows, sizeof(struct flow));
+    struct link *links = calloc(scn->num_links, sizeof(struct link));
+    struct packet_buffer lost = packet_buffer_empty;
+    struct rtt_hist *hist = calloc(1, sizeof(struct rtt_hist));
+    struct drand48_data rng;
+    bool loss_burst = false;
+    size_t in_flight = 0, peak_in_flight = 0;
+
+    srand48_r(seed, &rng);
+
+    for (size_t l = 0; l < scn->num_links; l++)
+        links[l].time_to_90 = NAN;
+
+    for (size_t i = 0; i < scn->num_flows; i++) {
+        long flow_seed;
+
+        lrand48_r(&rng, &flow_seed);
+        cc_init(&flows[i].cc, scn->flows[i].cc, &scn->flows[i].davis, time,
+                mss, scn->flows[i].pacing, flow_seed);
+        schedule_send(scn, &events, flows, time, i);
+    }
+
+    for (size_t l = 0; l < scn->num_links; l++) {
+        long qdisc_seed;
+
+        lrand48_r(&rng, &qdisc_seed);
+        qdisc_init(&links[l].qdisc, &scn->links[l].qdisc, qdisc_seed);
+
+        if (scn->links[l].capacity != NULL)
+            capacity_cursor_init(&links[l].capacity, scn->links[l].capacity);
+    }
+
+    while (event_queue_pop(&events, &event) && event.time < runtime) {
+        size_t flow = event.flow;
+        struct flow *f = &flows[flow];
+        struct link *l;
+        struct packet packet;
+        struct packet *net_packet;
+        bool forward = false;
+
+        time = event.time;
+
+        /*** Progress update ***/
+        unsigned int perc = 100*time/runtime;
+        if (progress && perc > last_perc) {
+            fprintf(stderr, "%u%%    \r", perc);
+            last_perc = perc;
+        }
+
+
+        if (event.type == ARRIVAL) {
+            packet_buffer_dequeue(&f->network, &packet);
+
+            if (packet_lost(scn, &rng, &loss_burst))
+                packet_buffer_enqueue(&lost, &packet);
+            else
+                link_arrival(scn, &events, links, &lost, time,
+                             scn->flows[flow].route[0], &packet);
+
+            net_packet = packet_buffer_peek(&f->network);
+            if (net_packet != NULL)
+                event_queue_push(&events,
+                                 packet_send_time(net_packet) + scn->flows[flow].rtt,
+                                 ARRIVAL, flow);
+        } else if (event.type == DEPARTURE) {
+            size_t link = event.flow;
+            double delay = scn->links[link].delay;
+
+            l = &links[link];
+            packet = l->in_service;
+
+            // Before link_serve() moves the cursor past this departure.
+            if (scn->links[link].capacity != NULL)
+                delay += capacity_delay(&l->capacity, time);
+
+            // Marked on the way out, by the queue it leaves behind.
+            if (scn->ecn_threshold > 0 && packet.ect
+                && l->qdisc.length >= scn->ecn_threshold)
+                packet.ce = 1;
+
+            link_serve(scn, &events, links, &lost, time, link);
+
+            // Utilization over back to back windows of the longest RTT,
+            // until the first that reaches 90%.
+            l->util_packets++;
+            if (isnan(l->time_to_90) && time - l->util_start >= scn->max_rtt) {
+                if (l->util_packets*mss
+                    >= 0.9*scenario_link_rate(scn, time, link)*(time - l->util_start))
+                    l->time_to_90 = time;
+
+                l->util_start = time;
+                l->util_packets = 0;
+            }
+
+            // A trace's delay may drop, but packets can't overtake
+            // the ones ahead of them.
+            if (delay > 0 || l->pipe.length > 0) {
+                double leave = fmax(time + delay, l->pipe_last);
+
+                if (l->pipe.length == 0)
+                    event_queue_push(&events, leave, FORWARD, link);
+
+                timed_buffer_enqueue(&l->pipe, &packet, leave);
+                l->pipe_last = leave;
+            } else {
+                forward = true;
+            }
+        } else if (event.type == FORWARD) {
+            double arrival;
+
+            l = &links[event.flow];
+            timed_buffer_dequeue(&l->pipe, &packet, &arrival);
+            forward = true;
+
+            if (l->pipe.length > 0)
+                event_queue_push(&events, timed_buffer_next(&l->pipe), FORWARD,
+                                 event.flow);
+        } else if (event.type == SEND) {
+            f->send_pending = false;
+
+            if (f->inflight < f->cc.cwnd && time >= f->next_send_time
+                && time >= f->pace_time) {
+                // Data arriving after an idle period is marked as the
+                // kernel does in tcp_sendmsg().
+                if (f->app_idle) {
+                    f->app_limited = f->pkts_delivered + f->inflight;
+                    f->app_idle = false;
+                }
+
+                packet = (struct packet) {
+                    .flow_id = flow,
+                    .delivered = f->pkts_delivered,
+                    .send_ticks = packet_ticks(time),
+                    .ect = scn->flows[flow].davis.ecn,
+                };
+
+                if (packet_buffer_peek(&f->network) == NULL)
+                    event_queue_push(&events, time + scn->flows[flow].rtt,
+                                     ARRIVAL, flow);
+
+                packet_buffer_enqueue(&f->network, &packet);
+
+                f->bytes_sent += mss;
+                f->inflight++;
+
+                if (++in_flight > peak_in_flight)
+                    peak_in_flight = in_flight;
+
+                app_next_send(scn, f, time, flow);
+                pace_packet(f, time, mss);
+
+                // Like tcp_rate_check_app_limited(), the flow is
+                // app-limited if cwnd has room but there is no more
+                // data. Without app_rate the application is a bulk
+                // transfer while it is on.
+                if (f->inflight < f->cc.cwnd
+                    && (scn->flows[flow].app_rate > 0 || f->app_idle))
+                    f->app_limited = f->pkts_delivered + f->inflight;
+            }
+
+            schedule_send(scn, &events, flows, time, flow);
+        }
+
+
+        /*** Next hop, or the receiver ***/
+        if (forward) {
+            const struct flow_config *cfg = &scn->flows[packet.flow_id];
+
+            flow = packet.flow_id;
+            f = &flows[flow];
+
+            if ((size_t) packet.hop + 1 < cfg->route_len) {
+                packet.hop++;
+                link_arrival(scn, &events, links, &lost, time,
+                             cfg->route[packet.hop], &packet);
+            } else {
+                struct cc_ack ack;
+                unsigned long sent_delivered;
+
+                if (f->inflight >= f->cc.cwnd)
+                    app_next_send(scn, f, time, flow);
+
+                f->inflight--;
+                in_flight--;
+                f->pkts_delivered++;
+
+                // Delivery rate sample over the packet's round trip, as
+                // tcp_rate.c takes it. Every simulated ACK delivers one
+                // packet, so the ACK elapsed time is just the RTT.
+                f->rtt = time - packet_send_time(&packet);
+                rtt_hist_add(hist, f->rtt);
+
+                sent_delivered = packet_delivered(&packet, f->pkts_delivered);
+
+                ack = (struct cc_ack) {
+                    .time = time,
+                    .rtt = f->rtt,
+                    .delivered = f->pkts_delivered - sent_delivered,
+                    .interval = f->rtt,
+                    .app_limited = sent_delivered <= f->app_limited,
+                    .ce = packet.ce,
+                    .inflight = f->inflight + 1,
+                };
+                cc_on_ack(&f->cc, &ack);
+
+                schedule_send(scn, &events, flows, time, flow);
+            }
+        }
+
+
+        while (packet_buffer_dequeue(&lost, &packet)) {
+            size_t flow = packet.flow_id;
+            struct flow *f = &flows[flow];
+
+            f->inflight--;
+            in_flight--;
+            f->losses++;
+
+            if (time >= f->recovery_end) {
+                f->recovery_end = time + (f->rtt > 0 ? f->rtt : scn->flows[flow].base_rtt);
+                cc_on_loss(&f->cc, time);
+            }
+
+            cc_on_packet_lost(&f->cc, f->inflight);
+
+            schedule_send(scn, &events, flows, time, flow);
+        }
+
+        /*** Log data ***/
+        if (trace != NULL && time > last_print_time + report_interval) {
+            for (size_t i = 0; i < scn->num_flows; i++) {
+                struct trace_record record = {
+                    .flow_id = i,
+                    .time = time,
+                    .rtt = flows[i].rtt,
+                    .bytes_sent = flows[i].bytes_sent,
+                    .losses = flows[i].losses,
+                };
+
+                cc_trace(&flows[i].cc, &record);
+                trace_write(trace, &record);
+
+                flows[i].bytes_sent = 0;
+            }
+
+            last_print_time = time;
+        }
+    }
+
+    summarize(scn, flows, hist, result);
+    result->peak_in_flight = peak_in_flight;
+    result->bottleneck_peak = 0;
+    result->time_to_90 = 0;
+
+    for (size_t l = 0; l < scn->num_links; l++) {
+        if (links[l].peak > result->bottleneck_peak)
+            result->bottleneck_peak = links[l].peak;
+
+        // NAN if any link in use never got there.
+        if (scn->links[l].max_rtt > 0 && !isnan(result->time_to_90)
+            && !(links[l].time_to_90 <= result->time_to_90))
+            result->time_to_90 = links[l].time_to_90;
+
+        qdisc_free(&links[l].qdisc);
+        timed_buffer_free(&links[l].pipe);
+    }
+
+    for (size_t i = 0; i < scn->num_flows; i++)
+        packet_buffer_free(&flows[i].network);
+
+    free(flows);
+    free(links);
+    free(hist);
+    packet_buffer_free(&lost);
+    event_queue_free(&events);
+}
@@ -0,0 +1,37 @@
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "cc.h"
+#include "scenario.h"
+#include "trace.h"
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+
+struct sim_result {
+    double throughput;      // Delivered bytes/s over the whole run
+    double jain;            // Over each flow's rate while active
+    double rtt_p50;
+    double rtt_p99;
+    unsigned long losses;
+    double time_to_90;      // Until every link has run at 90% over a
+                            // longest RTT, NAN if one never does
+    double share[NUM_CC];   // Of the bytes delivered, by each algorithm's
+                            // flows, NAN for those no flow runs
+
+    size_t peak_in_flight;
+    size_t bottleneck_peak; // Longest queue at any link
+};
+
+
+// Run a finalized scenario. Per-flow samples are written to trace
+// when it is non-NULL. Runs share no state, so any number may be in
+// progress at once on different threads.
+void sim_run(const struct scenario *scn, long seed, struct trace_writer *trace,
+             bool progress, struct sim_result *result);
+
+
+
+#endif /* _SIM_H_ */
@@ -1,222 +1,119 @@
 
 #include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
-#include "davis.h"
-#include "packet.h"
+#include "scenario.h"
+#include "sim.h"
+#include "sweep.h"
 
 
-#define MBPS 131072
-#define GBPS 134217728
-
-#define NUM_FLOWS 1
-const unsigned long MSS = 512;
-
-const double LOSS_PROB = 0.0;//2.5e-7;
-const int LOSS_RAND_CUTOFF = LOSS_PROB*RAND_MAX;
-
-static inline double base_rtt(double t, size_t flow) {
-    return 30e-3;//*(1 + flow/(NUM_FLOWS - 1.0));
-}
-
-static inline double max_bw(double t) { return 10.0*GBPS; }
-
-static inline double app_rate(double t, size_t flow) {
-    return 2*max_bw(t);
-}
-
-static inline unsigned long bdp(double t, size_t flow) {
-    return max_bw(t)*base_rtt(t, flow)/MSS;
-}
-
-unsigned long buf_size(double t) {
-    unsigned long max_bdp = 0;
-
-    for (size_t i = 0; i < NUM_FLOWS; i++) {
-        if (bdp(t, i) > max_bdp)
-            max_bdp = bdp(t, i);
-    }
-
-    return max_bdp;
-}
-
-const double RUNTIME = 60;
-static inline double report_interval(double t) {
-    if (NUM_FLOWS > 16)
-        return RUNTIME/100;
-    else
-        return RUNTIME/1000;
-}
-
-static inline double flow_start_time(size_t flow) {
-    double all_by = 10;//RUNTIME/4;
-    return flow*all_by/(NUM_FLOWS + 1);
+static void usage(FILE *out, const char *prog)
+{
+    fprintf(out,
+            "Usage: %s [OPTION]...\n"
+            "  -f FILE    Load a scenario file\n"
+            "  -e LINE    Apply a single scenario line\n"
+            "  -n FLOWS   Same as -e \"flows FLOWS\"\n"
+            "  -m MSS     Same as -e \"mss MSS\"\n"
+            "  -t TIME    Same as -e \"runtime TIME\"\n"
+            "  -r RATE    Same as -e \"rate RATE\"\n"
+            "  -d TIME    Same as -e \"flow * rtt=TIME\"\n"
+            "  -b BDPS    Same as -e \"buffer BDPS\"\n"
+            "  -l PROB    Same as -e \"loss PROB\"\n"
+            "  -i TIME    Same as -e \"report TIME\"\n"
+            "  -p         Same as -e \"flow * pacing=on\"\n"
+            "  -x AXIS    Sweep over a scenario line with a {a,b,...} list\n"
+            "  -j N       Number of sweep threads (default: one per core)\n"
+            "  -s SEED    Random seed (default: current time)\n"
+            "  -o FILE    Write the per-flow trace to FILE (default: stdout)\n"
+            "  -B         Write a binary trace, see simulation/common.py\n"
+            "Options are applied in order, so later ones override earlier ones.\n"
+            "Sweep axes are applied on top of them, and a sweep prints one summary\n"
+            "row per point instead of the per-flow trace, for example\n"
+            "  %s -t 20 -x \"flows {1,2,4}\" -x \"flow * rtt={10ms,30ms}\"\n\n",
+            prog, prog);
+    scenario_usage(out);
 }
 
 
-enum event_type { NONE, SEND, ARRIVAL, DEPARTURE };
-
-
 int main(int argc, char *argv[])
 {
-    struct davis d[NUM_FLOWS];
-
-    srand(time(NULL));
-
-    if ((int) (RAND_MAX*LOSS_PROB) == 0 && LOSS_PROB != 0.0)
-        fprintf(stderr, "Loss probability defaulting to 0\n");
-
-    printf("flow_id,time,rtt,cwnd,bytes_sent,losses,");
-    printf("gain_cwnd,pacing_rate,min_rtt,bdp,mode\n");
-
-    unsigned int last_perc = 0;
-    double last_print_time = 0;
-    double time = 0;
-
-    struct packet_buffer network[NUM_FLOWS] = {packet_buffer_empty};
-    struct packet_buffer bottleneck = packet_buffer_empty;
-    struct packet_buffer lost = packet_buffer_empty;
-    double next_bottleneck_time = time;
-    double next_send_time[NUM_FLOWS] = {time};
-
-    unsigned long inflight[NUM_FLOWS] = {0};
-    unsigned long bytes_sent[NUM_FLOWS] = {0};
-    unsigned long pkts_delivered[NUM_FLOWS] = {0};
-    unsigned long losses[NUM_FLOWS] = {0};
-    double last_loss_time[NUM_FLOWS] = {0};
-    double rtt[NUM_FLOWS] = {0};
-
-    for (size_t i = 0; i < NUM_FLOWS; i++)
-        davis_init(&d[i], time, MSS);
-
-    while (time < RUNTIME) {
-        enum event_type event = NONE;
-        size_t flow = 0;
-        struct packet *net_packet;
-        struct packet *bn_packet = packet_buffer_peek(&bottleneck);
-
-        /*** Caculate next event ***/
-        time = 2*RUNTIME;
-
-        for (size_t i = 0; i < NUM_FLOWS; i++) {
-            net_packet = packet_buffer_peek(&network[i]);
-
-            if (net_packet != NULL) {
-                double arrival_time = net_packet->send_time + base_rtt(net_packet->send_time, net_packet->flow_id);
-
-                if (arrival_time < time) {
-                    event = ARRIVAL;
-                    flow = net_packet->flow_id;
-                    time = arrival_time;
-                }
-            }
+    struct scenario scn;
+    struct sweep sweep = sweep_empty;
+    struct trace_writer trace;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long seed = time(NULL);
+    const char *trace_path = "-";
+    enum trace_format trace_format = TRACE_CSV;
+    char line[256];
+    bool ok = true;
+    int opt;
+
+    scenario_init(&scn);
+
+    while (ok && (opt = getopt(argc, argv, "f:e:n:m:t:r:d:b:l:i:px:j:s:o:Bh")) != -1) {
+        const char *format;
+
+        switch (opt) {
+        case 'f': ok = scenario_load(&scn, optarg); continue;
+        case 'x': ok = sweep_add_axis(&sweep, optarg); continue;
+        case 'j': ok = (threads = atol(optarg)) > 0; continue;
+        case 's': seed = atol(optarg); continue;
+        case 'o': trace_path = optarg; continue;
+        case 'B': trace_format = TRACE_BINARY; continue;
+        case 'e': format = "%s"; break;
+        case 'n': format = "flows %s"; break;
+        case 'm': format = "mss %s"; break;
+        case 't': format = "runtime %s"; break;
+        case 'r': format = "rate %s"; break;
+        case 'd': format = "flow * rtt=%s"; break;
+        case 'b': format = "buffer %s"; break;
+        case 'l': format = "loss %s"; break;
+        case 'i': format = "report %s"; break;
+        case 'p': format = "flow * pacing=on"; break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            ok = false;
+            continue;
         }
 
-        if (bn_packet != NULL && next_bottleneck_time < time) {
-            event = DEPARTURE;
-            flow = bn_packet->flow_id;
-            time = next_bottleneck_time;
-        }
-
-        for (size_t i = 0; i < NUM_FLOWS; i++) {
-            bool cond = flow_start_time(i) < time;
-            cond = cond && inflight[i] < d[i].cwnd;
-            cond = cond && next_send_time[i] < time;
-
-            if (cond) {
-                event = SEND;
-                flow = i;
-                time = next_send_time[i];
-
-                if (time < flow_start_time(i))
-                    time = flow_start_time(i);
-            }
-        }
-
-        /*** Progress update ***/
-        unsigned int perc = 100*time/RUNTIME;
-        if (perc > last_perc) {
-            fprintf(stderr, "%u%%    \r", perc);
-            last_perc = perc;
-        }
-
-
-        double send_rate[NUM_FLOWS];
-
-        for (size_t i = 0; i < NUM_FLOWS; i++) {
-            send_rate[i] = app_rate(time, i);
-
-            if (d[i].pacing_rate > 0 && d[i].pacing_rate < send_rate[i])
-                send_rate[i] = d[i].pacing_rate;
-        }
-
-
-        if (event == ARRIVAL) {
-            if (bn_packet == NULL)
-                next_bottleneck_time = time + MSS/max_bw(time);
-
-            net_packet = packet_buffer_dequeue(&network[flow]);
-
-            if (bottleneck.length >= buf_size(time) || rand() < LOSS_RAND_CUTOFF)
-                packet_buffer_enqueue(&lost, net_packet);
-            else
-                packet_buffer_enqueue(&bottleneck, net_packet);
-        } else if (event == DEPARTURE) {
-            if (inflight[flow] >= d[flow].cwnd)
-                next_send_time[flow] = time + MSS/send_rate[flow];
-
-            bn_packet = packet_buffer_dequeue(&bottleneck);
-            inflight[flow]--;
-            pkts_delivered[flow]++;
-
-            rtt[flow] = time - bn_packet->send_time;
-            davis_on_ack(&d[flow], time, rtt[flow], pkts_delivered[flow]);
-
-            next_bottleneck_time = time + MSS/max_bw(time);
-            free(bn_packet);
-        } else if (event == SEND) {
-            struct packet *p = malloc(sizeof(struct packet));
-            p->flow_id = flow;
-            p->send_time = time;
-            p->next = NULL;
-
-            packet_buffer_enqueue(&network[flow], p);
-
-            bytes_sent[flow] += MSS;
-            inflight[flow]++;
-
-            next_send_time[flow] = time + MSS/send_rate[flow];
-        }
-
-
-        struct packet *lost_packet = packet_buffer_dequeue(&lost);
-        while (lost_packet != NULL) {
-            size_t flow = lost_packet->flow_id;
-            inflight[flow]--;
-            losses[flow]++;
-            davis_on_loss(&d[flow], time);
-
-            free(lost_packet);
-            lost_packet = packet_buffer_dequeue(&lost);
-        }
-
-
-        /*** Log data ***/
-        if (time > last_print_time + report_interval(time)) {
-            for (size_t i = 0; i < NUM_FLOWS; i++) {
-                printf("%ld,%f,%f,%lu,%lu,%lu,", i, time, rtt[i],
-                       d[i].cwnd, bytes_sent[i], losses[i]);
-                printf("%lu,%f,%f,%lu,%u\n", d->gain_cwnd, d->pacing_rate,
-                       d[i].min_rtt, d[i].bdp, d[i].mode);
-
-                bytes_sent[i] = 0;
-            }
+        snprintf(line, sizeof(line), format, optarg);
+        ok = scenario_parse_line(&scn, line, "command line", optind - 1);
+    }
 
-            last_print_time = time;
+    if (!ok || optind < argc) {
+        usage(stderr, argv[0]);
+    } else if (sweep.num_axes > 0) {
+        ok = sweep_run(&sweep, &scn, seed, threads, stdout);
+    } else if ((ok = scenario_finalize(&scn))
+               && (ok = trace_open(&trace, trace_path, trace_format))) {
+        struct sim_result result;
+
+        sim_run(&scn, seed, &trace, true, &result);
+        trace_close(&trace);
+
+        fprintf(stderr, "Peak packets in flight: %zu (bottleneck peak %zu)\n",
+                result.peak_in_flight, result.bottleneck_peak);
+        fprintf(stderr, "Throughput %f bytes/s, Jain %f, RTT p50 %f p99 %f, %lu losses\n",
+                result.throughput, result.jain, result.rtt_p50,
+                result.rtt_p99, result.losses);
+        fprintf(stderr, "90%% utilization after %f s\n", result.time_to_90);
+
+        for (int a = 0; a < NUM_CC; a++) {
+            if (!isnan(result.share[a]) && result.share[a] < 1)
+                fprintf(stderr, "%s flows got %f of the throughput\n",
+                        cc_names[a], result.share[a]);
         }
     }
 
-    return 0;
+    sweep_free(&sweep);
+    scenario_free(&scn);
+
+    return ok && optind == argc ? 0 : 1;
 }
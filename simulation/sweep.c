@@ -0,0 +1,208 @@
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "sim.h"
+#include "sweep.h"
+
+
+struct sweep_job {
+    struct scenario *scenarios;
+    struct sim_result *results;
+    size_t num_points;
+    long seed;
+
+    atomic_size_t next;
+    atomic_size_t done;
+};
+
+
+bool sweep_add_axis(struct sweep *sweep, const char *line)
+{
+    const char *open = strchr(line, '{');
+    const char *close = open != NULL ? strchr(open, '}') : NULL;
+    struct sweep_axis axis = {NULL, NULL, NULL, 0};
+    size_t prefix_len, name_len;
+    const char *value;
+
+    if (close == NULL || close == open + 1) {
+        fprintf(stderr, "Sweep axis \"%s\" needs a {a,b,...} list\n", line);
+        return false;
+    }
+
+    prefix_len = open - line;
+    name_len = prefix_len;
+
+    while (name_len > 0 && strchr(" \t=", line[name_len - 1]) != NULL)
+        name_len--;
+
+    axis.name = strndup(line, name_len);
+
+    for (value = open + 1; value < close; ) {
+        const char *end = memchr(value, ',', close - value);
+        size_t len, line_len;
+        char *full;
+
+        end = end != NULL ? end : close;
+        len = end - value;
+        line_len = prefix_len + len + strlen(close + 1);
+
+        full = malloc(line_len + 1);
+        memcpy(full, line, prefix_len);
+        memcpy(full + prefix_len, value, len);
+        strcpy(full + prefix_len + len, close + 1);
+
+        axis.values = realloc(axis.values, (axis.num_values + 1)*sizeof(char*));
+        axis.lines = realloc(axis.lines, (axis.num_values + 1)*sizeof(char*));
+        axis.values[axis.num_values] = strndup(value, len);
+        axis.lines[axis.num_values] = full;
+        axis.num_values++;
+
+        value = end + 1;
+    }
+
+    sweep->axes = realloc(sweep->axes, (sweep->num_axes + 1)*sizeof(axis));
+    sweep->axes[sweep->num_axes++] = axis;
+
+    return true;
+}
+
+
+size_t sweep_num_points(const struct sweep *sweep)
+{
+    size_t points = 1;
+
+    for (size_t i = 0; i < sweep->num_axes; i++)
+        points *= sweep->axes[i].num_values;
+
+    return points;
+}
+
+
+// Index of the value axis takes in point, with the first axis varying
+// slowest.
+static size_t axis_value(const struct sweep *sweep, size_t axis, size_t point)
+{
+    for (size_t i = sweep->num_axes; i-- > axis + 1; )
+        point /= sweep->axes[i].num_values;
+
+    return point%sweep->axes[axis].num_values;
+}
+
+
+static void* sweep_worker(void *arg)
+{
+    struct sweep_job *job = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->num_points) {
+        sim_run(&job->scenarios[i], job->seed + i, NULL, false,
+                &job->results[i]);
+
+        fprintf(stderr, "%zu/%zu points    \r",
+                atomic_fetch_add(&job->done, 1) + 1, job->num_points);
+    }
+
+    return NULL;
+}
+
+
+bool sweep_run(const struct sweep *sweep, const struct scenario *base,
+               long seed, unsigned int threads, FILE *out)
+{
+    struct sweep_job job;
+    pthread_t *workers;
+    unsigned int started = 0;
+    size_t built = 0;
+    bool ok = true;
+
+    job.num_points = sweep_num_points(sweep);
+    job.scenarios = calloc(job.num_points, sizeof(struct scenario));
+    job.results = calloc(job.num_points, sizeof(struct sim_result));
+    job.seed = seed;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.done, 0);
+
+    for (; ok && built < job.num_points; built++) {
+        struct scenario *scn = &job.scenarios[built];
+
+        scenario_copy(scn, base);
+
+        for (size_t a = 0; ok && a < sweep->num_axes; a++) {
+            const char *line = sweep->axes[a].lines[axis_value(sweep, a, built)];
+            ok = scenario_parse_line(scn, line, "sweep", a + 1);
+        }
+
+        ok = ok && scenario_finalize(scn);
+    }
+
+    if (ok) {
+        if (threads > job.num_points)
+            threads = job.num_points;
+
+        workers = malloc(threads*sizeof(pthread_t));
+
+        while (workers != NULL && started < threads
+               && pthread_create(&workers[started], NULL, sweep_worker, &job) == 0)
+            started++;
+
+        // The calling thread works through whatever the missing threads
+        // would have, so the sweep still completes, just more slowly.
+        if (started < threads) {
+            fprintf(stderr, "Could only start %u of %u sweep threads\n",
+                    started, threads);
+            sweep_worker(&job);
+        }
+
+        for (unsigned int i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+
+        free(workers);
+
+        fprintf(out, "point");
+        for (size_t a = 0; a < sweep->num_axes; a++)
+            fprintf(out, ",%s", sweep->axes[a].name);
+        fprintf(out, ",throughput,jain,rtt_p50,rtt_p99,losses,time_to_90,davis_share\n");
+
+        for (size_t i = 0; i < job.num_points; i++) {
+            struct sim_result *r = &job.results[i];
+
+            fprintf(out, "%zu", i);
+            for (size_t a = 0; a < sweep->num_axes; a++)
+                fprintf(out, ",%s", sweep->axes[a].values[axis_value(sweep, a, i)]);
+            fprintf(out, ",%f,%f,%f,%f,%lu,%f,%f\n", r->throughput, r->jain,
+                    r->rtt_p50, r->rtt_p99, r->losses, r->time_to_90,
+                    r->share[CC_DAVIS]);
+        }
+    }
+
+    for (size_t i = 0; i < built; i++)
+        scenario_free(&job.scenarios[i]);
+
+    free(job.scenarios);
+    free(job.results);
+
+    return ok;
+}
+
+
+void sweep_free(struct sweep *sweep)
+{
+    for (size_t a = 0; a < sweep->num_axes; a++) {
+        struct sweep_axis *axis = &sweep->axes[a];
+
+        for (size_t i = 0; i < axis->num_values; i++) {
+            free(axis->values[i]);
+            free(axis->lines[i]);
+        }
+
+        free(axis->name);
+        free(axis->values);
+        free(axis->lines);
+    }
+
+    free(sweep->axes);
+    sweep->axes = NULL;
+    sweep->num_axes = 0;
+}
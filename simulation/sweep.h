@@ -0,0 +1,46 @@
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scenario.h"
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+
+// One dimension of a parameter sweep, given as a scenario line with a
+// brace list, such as "flow * rtt={10ms,30ms,100ms}".
+struct sweep_axis {
+    char *name;
+    char **values;
+    char **lines;
+    size_t num_values;
+};
+
+// The cartesian product of all axes.
+struct sweep {
+    struct sweep_axis *axes;
+    size_t num_axes;
+};
+
+
+#define sweep_empty {NULL, 0}
+
+
+bool sweep_add_axis(struct sweep *sweep, const char *line);
+
+size_t sweep_num_points(const struct sweep *sweep);
+
+// Run every point of the sweep on top of base, spread over threads
+// workers, and write one summary row per point to out. Point i is
+// simulated with seed + i, so results don't depend on the number of
+// threads.
+bool sweep_run(const struct sweep *sweep, const struct scenario *base,
+               long seed, unsigned int threads, FILE *out);
+
+void sweep_free(struct sweep *sweep);
+
+
+
+#endif /* _SWEEP_H_ */
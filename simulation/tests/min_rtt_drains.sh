@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Runs Davis for long enough that its first min RTT sample would have
+# aged out of the filter several times over, and checks that a drain
+# empties the bottleneck at least once per rtt_timeout, so that the min
+# RTT and the BDP don't creep up with a standing queue.
+
+set -e
+
+
+if [ $# -lt 1 ]
+then
+    echo "Usage: $0 SIMULATION [RUNTIME]"
+    exit 1
+fi
+
+SIMULATION=$1
+RUNTIME=${2:-300}
+
+# The default rtt_timeout, with a second for the gain in progress to end.
+TIMEOUT=10
+SLACK=1
+
+
+$SIMULATION -t $RUNTIME -r 1gbits -n 2 -s 1 -i 10ms 2> /dev/null | awk -F, \
+    -v timeout=$TIMEOUT -v slack=$SLACK -v runtime=$RUNTIME '
+    NR == 1 {
+        for (i = 1; i <= NF; i++)
+            col[$i] = i
+        next
+    }
+
+    {
+        flow = $col["flow_id"]
+        time = $col["time"]
+        mode = $col["mode"]
+        min_rtt = $col["min_rtt"]
+
+        # DRAIN is mode 0.
+        if (mode == 0 && seen[flow] && last_mode[flow] != 0) {
+            if (last_drain > 0 && time - last_drain > max_gap)
+                max_gap = time - last_drain
+            last_drain = time
+        }
+
+        if (min_rtt > 0 && (base == 0 || min_rtt < base))
+            base = min_rtt
+        if (min_rtt > max_min_rtt)
+            max_min_rtt = min_rtt
+
+        seen[flow] = 1
+        last_mode[flow] = mode
+    }
+
+    END {
+        if (runtime - last_drain > max_gap)
+            max_gap = runtime - last_drain
+
+        printf "longest time without a drain %.3fs, min RTT %.6f to %.6f\n",
+            max_gap, base, max_min_rtt
+
+        if (max_gap > timeout + slack) {
+            print "FAIL: no drain for more than rtt_timeout"
+            exit 1
+        }
+
+        if (max_min_rtt > base*1.125) {
+            print "FAIL: min RTT crept up"
+            exit 1
+        }
+    }'
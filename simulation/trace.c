@@ -0,0 +1,74 @@
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+#define TRACE_BUFFER_SIZE (4 << 20)
+
+_Static_assert(sizeof(struct trace_record) == 64,
+               "trace_record must match traceDtype in common.py");
+
+
+bool trace_open(struct trace_writer *trace, const char *path,
+                enum trace_format format)
+{
+    trace->format = format;
+    trace->file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+
+    if (trace->file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    // Without the big buffer the trace is just written in smaller
+    // pieces, using stdio's own.
+    trace->buffer = malloc(TRACE_BUFFER_SIZE);
+    if (trace->buffer != NULL)
+        setvbuf(trace->file, trace->buffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    if (format == TRACE_BINARY) {
+        struct trace_header header;
+
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(struct trace_record);
+
+        fwrite(&header, sizeof(header), 1, trace->file);
+    } else {
+        fprintf(trace->file, "flow_id,time,rtt,cwnd,bytes_sent,losses,");
+        fprintf(trace->file, "gain_cwnd,pacing_rate,min_rtt,bdp,mode\n");
+    }
+
+    return true;
+}
+
+
+void trace_write(struct trace_writer *trace,
+                 const struct trace_record *r)
+{
+    if (trace->format == TRACE_BINARY) {
+        fwrite(r, sizeof(*r), 1, trace->file);
+    } else {
+        fprintf(trace->file, "%" PRIu32 ",%f,%f,%" PRIu32 ",%" PRIu64 ",%" PRIu32 ",",
+                r->flow_id, r->time, r->rtt, r->cwnd, r->bytes_sent, r->losses);
+        fprintf(trace->file, "%" PRIu32 ",%f,%f,%" PRIu32 ",%" PRIu32 "\n",
+                r->gain_cwnd, r->pacing_rate, r->min_rtt, r->bdp, r->mode);
+    }
+}
+
+
+void trace_close(struct trace_writer *trace)
+{
+    // stdout keeps using its buffer until exit, so leave it attached.
+    if (trace->file == stdout) {
+        fflush(stdout);
+    } else {
+        fclose(trace->file);
+        free(trace->buffer);
+    }
+
+    trace->file = NULL;
+}
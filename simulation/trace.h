@@ -0,0 +1,55 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+
+enum trace_format { TRACE_CSV, TRACE_BINARY };
+
+// Binary traces start with a struct trace_header followed by packed
+// host-endian records. Keep this in sync with traceDtype in common.py.
+#define TRACE_MAGIC "DAVISTR1"
+#define TRACE_VERSION 1
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct trace_record {
+    uint32_t flow_id;
+    uint32_t mode;
+    double time;
+    double rtt;
+    double min_rtt;
+    double pacing_rate;
+    uint64_t bytes_sent;
+    uint32_t cwnd;
+    uint32_t gain_cwnd;
+    uint32_t bdp;
+    uint32_t losses;
+};
+
+struct trace_writer {
+    FILE *file;
+    enum trace_format format;
+    char *buffer;
+};
+
+
+// Open path ("-" for stdout) and write the CSV or binary header.
+bool trace_open(struct trace_writer *trace, const char *path,
+                enum trace_format format);
+
+void trace_write(struct trace_writer *trace,
+                 const struct trace_record *record);
+
+void trace_close(struct trace_writer *trace);
+
+
+
+#endif /* _TRACE_H_ */
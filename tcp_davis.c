@@ -5,82 +5,288 @@
 
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/ratelimit.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
 #include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
 #include <linux/inet_diag.h>
 
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
 #include <net/tcp.h>
 
 
+#define CREATE_TRACE_POINTS
+#include "davis_trace.h"
+
+
 #define DAVIS_PRNT "tcp_davis: "
 //#define DAVIS_DEBUG
 
-#define DAVIS_ONE 1024
+#ifdef DAVIS_DEBUG
+static DEFINE_RATELIMIT_STATE(davis_debug_rs, HZ/4, 1);
+#endif
 
-static const u32 MIN_CWND = 4;
+// The core only knows about its struct davis, which lives in the
+// socket's icsk_ca_priv.
+static inline struct sock *davis_sk(void *davis)
+{
+    return (struct sock *) container_of(davis, struct inet_connection_sock,
+                                        icsk_ca_priv);
+}
 
-static u32 MIN_GAIN_CWND = 4;
-static u32 REACTIVITY = DAVIS_ONE/8;
-static u32 SENSITIVITY = DAVIS_ONE/64;
+#define davis_trace_mode(davis, new_mode)                               \
+    trace_davis_mode(davis_sk(davis), (davis)->mode, new_mode,          \
+                     (davis)->bdp, davis_min_rtt(davis))
+#define davis_trace_bdp(davis, diff_deliv, interval)                    \
+    trace_davis_bdp(davis_sk(davis), diff_deliv, interval,              \
+                    davis_min_rtt(davis), (davis)->bdp)
+#define davis_trace_gain_cwnd(davis)                                    \
+    trace_davis_gain_cwnd(davis_sk(davis), (davis)->bdp,                \
+                          (davis)->last_bdp, (davis)->gain_cwnd)
 
-static const u32 DRAIN_RTTS = 2;
-static u32 STABLE_RTTS_MIN = 3;
-static u32 STABLE_RTTS_MAX = 6;
-static const u32 GAIN_1_RTTS = 2;
-static const u32 GAIN_2_RTTS = 1;
+#include "davis_core.h"
 
-static const u32 RTT_INF = U32_MAX;
-static u32 RTT_TIMEOUT_MS = 10*MSEC_PER_SEC;
 
+// Defaults for each new network namespace. They are checked when the
+// module loads, and can't be changed afterwards; tune a running system
+// through the net.ipv4.tcp_davis sysctls instead.
+static struct davis_params davis_params = DAVIS_PARAMS_INIT;
 
-// TODO: These parameters should be non-zero. Not sure if it's worth
-// writing a custom parameter op for this.
 
 // These are the parameters that really affect performance, and
 // therefore should be tuneable. Making the other parameters
 // configurable would mainly just be confusing and possibly result in
 // bad behavior.
 
-module_param(REACTIVITY, uint, 0644);
+module_param_named(REACTIVITY, davis_params.reactivity, uint, 0444);
 MODULE_PARM_DESC(REACTIVITY, "");
 
-module_param(SENSITIVITY, uint, 0644);
+module_param_named(SENSITIVITY, davis_params.sensitivity, uint, 0444);
 MODULE_PARM_DESC(SENSITIVITY, "");
 
-module_param(STABLE_RTTS_MIN, uint, 0644);
+module_param_named(STABLE_RTTS_MIN, davis_params.stable_rtts_min, uint, 0444);
 MODULE_PARM_DESC(STABLE_RTTS_MIN, "");
 
-module_param(STABLE_RTTS_MAX, uint, 0644);
+module_param_named(STABLE_RTTS_MAX, davis_params.stable_rtts_max, uint, 0444);
 MODULE_PARM_DESC(STABLE_RTTS_MAX, "");
 
-module_param(MIN_GAIN_CWND, uint, 0644);
+module_param_named(MIN_GAIN_CWND, davis_params.min_gain_cwnd, uint, 0444);
 MODULE_PARM_DESC(MIN_GAIN_CWND, "Minimum increase in snd_cwnd on each gain (packets)");
 
-module_param(RTT_TIMEOUT_MS, uint, 0644);
+module_param_named(RTT_TIMEOUT_MS, davis_params.rtt_timeout_ms, uint, 0444);
 MODULE_PARM_DESC(RTT_TIMEOUT_MS, "Timeout to probe for new RTT (milliseconds)");
 
+module_param_named(PACING_GAIN_SLOW_START, davis_params.pacing_gain_slow_start, uint, 0444);
+MODULE_PARM_DESC(PACING_GAIN_SLOW_START, "Pacing gain in slow start (1024 = 1.0)");
 
-enum davis_mode { DAVIS_DRAIN, DAVIS_STABLE, DAVIS_GAIN_1, DAVIS_GAIN_2 };
+module_param_named(PACING_GAIN_DRAIN, davis_params.pacing_gain_drain, uint, 0444);
+MODULE_PARM_DESC(PACING_GAIN_DRAIN, "Pacing gain while draining (1024 = 1.0)");
 
-struct davis {
-    enum davis_mode mode;
-    u64 trans_time;
-    u64 min_rtt_time;
-    u64 delivered_start_time;
+module_param_named(PACING_GAIN_STABLE, davis_params.pacing_gain_stable, uint, 0444);
+MODULE_PARM_DESC(PACING_GAIN_STABLE, "Pacing gain when stable (1024 = 1.0)");
 
-    u32 delivered_start;
+module_param_named(PACING_GAIN_PROBE, davis_params.pacing_gain_probe, uint, 0444);
+MODULE_PARM_DESC(PACING_GAIN_PROBE, "Pacing gain while gaining (1024 = 1.0)");
 
-    u32 bdp;
-    u32 last_bdp;
-    u32 gain_cwnd;
+module_param_named(STARTUP, davis_params.startup, uint, 0444);
+MODULE_PARM_DESC(STARTUP, "Startup, 0 for classic or 1 for rate doubling");
 
-    u32 stable_rtts;
+// Read only, since whether to negotiate ECN is fixed at registration.
+module_param_named(ECN, davis_params.ecn, uint, 0444);
+MODULE_PARM_DESC(ECN, "Negotiate ECN and back off in proportion to CE marks");
 
-    u32 last_rtt;
-    u32 min_rtt;
 
-#ifdef DAVIS_DEBUG
-    u64 last_debug_time;
-#endif
+// Each namespace publishes its parameters as an immutable copy. A
+// sysctl write validates the changed set and replaces the copy, and
+// sockets take a reference to whichever copy is current at init and
+// keep it until release. So tuning only affects new connections, and
+// the ACK path reads parameters nobody writes.
+struct davis_params_ref {
+    struct davis_params params;
+    refcount_t refcnt;
+    struct rcu_head rcu;
+};
+
+struct davis_net {
+    struct davis_params_ref __rcu *params;
+    struct mutex lock;          // Serialises sysctl writes
+    struct ctl_table_header *sysctl;
+};
+
+static unsigned int davis_net_id __read_mostly;
+
+
+static struct davis_params_ref *davis_params_alloc(const struct davis_params *params)
+{
+    struct davis_params_ref *ref = kmalloc(sizeof(*ref), GFP_KERNEL);
+
+    if (ref == NULL)
+        return NULL;
+
+    ref->params = *params;
+    refcount_set(&ref->refcnt, 1);
+    return ref;
+}
+
+
+static void davis_params_put(const struct davis_params *params)
+{
+    struct davis_params_ref *ref =
+        container_of(params, struct davis_params_ref, params);
+
+    // Freed after a grace period, since davis_params_get() may still
+    // be looking at it.
+    if (refcount_dec_and_test(&ref->refcnt))
+        kfree_rcu(ref, rcu);
+}
+
+
+static const struct davis_params *davis_params_get(struct net *net)
+{
+    struct davis_net *dn = net_generic(net, davis_net_id);
+    struct davis_params_ref *ref;
+
+    // The count only drops to zero once a write has replaced the copy,
+    // so looking again finds the new one.
+    rcu_read_lock();
+    do {
+        ref = rcu_dereference(dn->params);
+    } while (!refcount_inc_not_zero(&ref->refcnt));
+    rcu_read_unlock();
+
+    return &ref->params;
+}
+
+
+static int davis_sysctl_params(struct ctl_table *ctl, int write,
+                               void *buffer, size_t *lenp, loff_t *ppos)
+{
+    struct davis_net *dn = ctl->extra1;
+    size_t offset = (char *) ctl->data - (char *) &davis_params;
+    struct davis_params_ref *old, *new;
+    struct davis_params params;
+    struct ctl_table tmp = *ctl;
+    const char *err;
+    int ret;
+
+    mutex_lock(&dn->lock);
+
+    // Edit a copy of the namespace's parameters, so a rejected write
+    // leaves them as they were.
+    old = rcu_dereference_protected(dn->params, lockdep_is_held(&dn->lock));
+    params = old->params;
+    tmp.data = (char *) &params + offset;
+
+    ret = proc_douintvec(&tmp, write, buffer, lenp, ppos);
+    if (ret != 0 || !write)
+        goto out;
+
+    err = davis_params_check(&params);
+    if (err != NULL) {
+        net_warn_ratelimited(DAVIS_PRNT "%s: %s\n", ctl->procname, err);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    new = davis_params_alloc(&params);
+    if (new == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    rcu_assign_pointer(dn->params, new);
+    davis_params_put(&old->params);
+
+out:
+    mutex_unlock(&dn->lock);
+    return ret;
+}
+
+
+// data points into davis_params only to name the field; the handler
+// applies it to the namespace's copy. ECN isn't here since it is fixed
+// at registration.
+#define DAVIS_SYSCTL(field) {                   \
+        .procname = #field,                     \
+        .data = &davis_params.field,            \
+        .maxlen = sizeof(u32),                  \
+        .mode = 0644,                           \
+        .proc_handler = davis_sysctl_params,    \
+    }
+
+static struct ctl_table davis_sysctl_table[] = {
+    DAVIS_SYSCTL(reactivity),
+    DAVIS_SYSCTL(sensitivity),
+    DAVIS_SYSCTL(stable_rtts_min),
+    DAVIS_SYSCTL(stable_rtts_max),
+    DAVIS_SYSCTL(min_gain_cwnd),
+    DAVIS_SYSCTL(rtt_timeout_ms),
+    DAVIS_SYSCTL(pacing_gain_slow_start),
+    DAVIS_SYSCTL(pacing_gain_drain),
+    DAVIS_SYSCTL(pacing_gain_stable),
+    DAVIS_SYSCTL(pacing_gain_probe),
+    DAVIS_SYSCTL(startup),
+    { }
+};
+
+
+static int __net_init davis_net_init(struct net *net)
+{
+    struct davis_net *dn = net_generic(net, davis_net_id);
+    struct davis_params_ref *ref;
+    struct ctl_table *table;
+    int i;
+
+    mutex_init(&dn->lock);
+
+    ref = davis_params_alloc(&davis_params);
+    if (ref == NULL)
+        return -ENOMEM;
+    RCU_INIT_POINTER(dn->params, ref);
+
+    table = kmemdup(davis_sysctl_table, sizeof(davis_sysctl_table), GFP_KERNEL);
+    if (table == NULL)
+        goto err_table;
+
+    for (i = 0; i < ARRAY_SIZE(davis_sysctl_table) - 1; i++)
+        table[i].extra1 = dn;
+
+    dn->sysctl = register_net_sysctl(net, "net/ipv4/tcp_davis", table);
+    if (dn->sysctl == NULL)
+        goto err_register;
+
+    return 0;
+
+err_register:
+    kfree(table);
+err_table:
+    davis_params_put(&ref->params);
+    return -ENOMEM;
+}
+
+
+static void __net_exit davis_net_exit(struct net *net)
+{
+    struct davis_net *dn = net_generic(net, davis_net_id);
+    struct ctl_table *table = dn->sysctl->ctl_table_arg;
+
+    unregister_net_sysctl_table(dn->sysctl);
+    kfree(table);
+
+    // Sockets still holding this copy keep it alive.
+    davis_params_put(&rcu_dereference_protected(dn->params, true)->params);
+}
+
+
+static struct pernet_operations davis_net_ops = {
+    .init = davis_net_init,
+    .exit = davis_net_exit,
+    .id   = &davis_net_id,
+    .size = sizeof(struct davis_net),
 };
 
 
@@ -94,69 +300,61 @@ static inline u64 davis_current_time(struct sock *sk)
 static inline u64 rate_adj(struct sock *sk)
 {
     struct tcp_sock *tp = tcp_sk(sk);
-    return tp->mss_cache*USEC_PER_SEC;
+    return (u64) tp->mss_cache*USEC_PER_SEC;
 }
 
 
-static void davis_enter_slow_start(struct sock *sk, u64 now)
+// Leaves the stack's rate alone until init has taken the parameters.
+static void davis_update_pacing_rate(struct sock *sk)
 {
     struct davis *davis = inet_csk_ca(sk);
     struct tcp_sock *tp = tcp_sk(sk);
+    u64 rate;
 
-    davis->mode = DAVIS_GAIN_1;
-    davis->trans_time = now;
+    if (davis->params == NULL)
+        return;
 
-    davis->bdp = MIN_CWND;
-    davis->last_bdp = 0;
+    rate = davis_pacing_rate(davis, davis->params, tp->snd_cwnd,
+                             tp->snd_ssthresh, tp->mss_cache);
 
-    tp->snd_cwnd = MIN_CWND;
+    // Until there is a min RTT, pace the window over the handshake RTT
+    // (or 1ms without one) at the slow start gain.
+    if (rate == 0) {
+        u32 rtt_us = tp->srtt_us ? max(tp->srtt_us >> 3, 1U) : USEC_PER_MSEC;
 
-    davis->min_rtt = davis->last_rtt;
+        rate = div_u64(tp->snd_cwnd*rate_adj(sk), rtt_us);
+        rate = (rate*davis->params->pacing_gain_slow_start) >> DAVIS_SHIFT;
+    }
+
+    sk->sk_pacing_rate = min_t(u64, rate, sk->sk_max_pacing_rate);
 }
 
 
-static void update_gain_cwnd(struct sock *sk)
+// rs may be NULL when there is no ACK to take a rate sample from.
+static inline void davis_fill_ack(struct sock *sk, u64 now, u32 rtt,
+                                  const struct rate_sample *rs,
+                                  struct davis_ack *ack)
 {
-    // Gain cwnd = REACTIVITY  * BDP    given unlimited growth
-    // Gain cwnd = SENSITIVITY * BDP    when stable
-    // See Lucas sequence.
-    //
-    // Essentially, start by solving the long term behavior of
-    // snd_cwnd[0] = w
-    // snd_cwnd[1] = w
-    // snd_cwnd[n] = (1 + alpha)*snd_cwnd[n-1] + beta*snd_cwnd[n-2]
-    //
-    // You will get something like
-    // snd_cwnd[n] = C*x^n + D*y^n
-    //
-    // It is the case that C*x^n + D*y^n = O(max(x,y)^n)
-    // So, we can find alpha and beta by solving
-    // max(x, y) = REACTIVITY
-    // (1 + SENSITIVITY)*snd_cwnd = (1 + alpha)*snd_cwnd + beta*snd_cwnd
-    //
-    // Hope this helps any unfortunate readers (possibly future me)
-    // who are trying to puzzle this out. :)
-
     struct davis *davis = inet_csk_ca(sk);
-    s32 gain;
-    s32 alpha, beta;
-
-    if (REACTIVITY <= SENSITIVITY) {
-        printk(KERN_ERR DAVIS_PRNT
-               "bad reactivity value (%d), must be > %d\n",
-                REACTIVITY, SENSITIVITY);
-
-        REACTIVITY = SENSITIVITY + 1;
-    }
+    struct tcp_sock *tp = tcp_sk(sk);
 
-    alpha = DAVIS_ONE + REACTIVITY - SENSITIVITY*DAVIS_ONE/REACTIVITY;
-    beta = SENSITIVITY - alpha;
+    ack->now = now;
+    ack->rtt = rtt;
+    ack->app_limited = tp->app_limited != 0;
 
-    gain = alpha*davis->bdp + beta*davis->last_bdp;
-    gain = max_t(s32, gain, SENSITIVITY*davis->bdp);
-    gain = max_t(s32, gain, MIN_GAIN_CWND*DAVIS_ONE);
+    // An ACK with ECE means everything it acknowledges was CE marked,
+    // since the receiver echoes every CE in ECN mode.
+    ack->acked = rs != NULL ? rs->acked_sacked : 0;
+    ack->ce = davis->ece ? ack->acked : 0;
 
-    davis->gain_cwnd = gain/DAVIS_ONE;
+    if (rs != NULL && rs->delivered > 0 && rs->interval_us > 0) {
+        ack->delivered = rs->delivered;
+        ack->interval = rs->interval_us;
+        ack->app_limited |= rs->is_app_limited;
+    } else {
+        ack->delivered = 0;
+        ack->interval = 0;
+    }
 }
 
 
@@ -164,32 +362,18 @@ void tcp_davis_init(struct sock *sk)
 {
     struct tcp_sock *tp = tcp_sk(sk);
     struct davis *davis = inet_csk_ca(sk);
+    struct davis_ack ack;
     u64 now = davis_current_time(sk);
 
-    davis->mode = DAVIS_GAIN_1;
-    davis->trans_time = now;
-
-    tp->snd_cwnd = MIN_CWND;
-    tp->snd_ssthresh = TCP_INFINITE_SSTHRESH;
-
-    davis->delivered_start = tp->delivered;
-    davis->delivered_start_time = tp->delivered_mstamp;
-
-    davis->bdp = MIN_CWND;
-    davis->last_bdp = 0;
-    davis->gain_cwnd = MIN_GAIN_CWND;
-
-    davis->stable_rtts = STABLE_RTTS_MIN;
-
-    sk->sk_pacing_rate = 0;
+    davis->params = davis_params_get(sock_net(sk));
 
-    davis->last_rtt = 0;
-    davis->min_rtt = RTT_INF;
-    davis->min_rtt_time = now;
+    davis_fill_ack(sk, now, 0, NULL, &ack);
+    davis_core_init(davis, davis->params, &ack,
+                    &tp->snd_cwnd, &tp->snd_ssthresh);
 
-#ifdef DAVIS_DEBUG
-    davis->last_debug_time = now;
-#endif
+    // Ask the stack to pace for us when there is no fq qdisc.
+    cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
+    davis_update_pacing_rate(sk);
 }
 EXPORT_SYMBOL_GPL(tcp_davis_init);
 
@@ -197,98 +381,118 @@ EXPORT_SYMBOL_GPL(tcp_davis_init);
 void tcp_davis_release(struct sock *sk)
 {
     struct davis *davis = inet_csk_ca(sk);
+
+    // Sockets that never reached init have zeroed state.
+    if (davis->params != NULL) {
+        davis_params_put(davis->params);
+        davis->params = NULL;
+    }
 }
 EXPORT_SYMBOL_GPL(tcp_davis_release);
 
 
+// The stack calls this for losses and for ECN alike, before it says
+// which, so the back off is done in tcp_davis_set_state() instead.
 u32 tcp_davis_ssthresh(struct sock *sk)
 {
-    struct tcp_sock *tp = tcp_sk(sk);
-
-    return tp->snd_ssthresh;
+    return tcp_sk(sk)->snd_ssthresh;
 }
 EXPORT_SYMBOL_GPL(tcp_davis_ssthresh);
 
 
-void tcp_davis_cwnd_event(struct sock *sk, enum tcp_ca_event ev)
+// A loss episode starts when the stack enters Recovery or Loss from
+// any other state, which it also does for a loss on an ECE ACK or one
+// during CWR. CWR alone is left to ce_frac, which already counts the
+// CE marks.
+void tcp_davis_set_state(struct sock *sk, u8 new_state)
 {
+    struct davis *davis = inet_csk_ca(sk);
+    struct tcp_sock *tp = tcp_sk(sk);
+    u8 old_state = inet_csk(sk)->icsk_ca_state;
     u64 now = davis_current_time(sk);
 
-    if (ev == CA_EVENT_CWND_RESTART)
-        davis_enter_slow_start(sk, now);
+    // A SYN timeout gets here before init, with nothing to back off
+    // from yet.
+    if (davis->params == NULL)
+        return;
+
+    if (new_state != TCP_CA_Recovery && new_state != TCP_CA_Loss)
+        return;
+    if (old_state == TCP_CA_Recovery || old_state == TCP_CA_Loss)
+        return;
+
+    davis_core_on_loss(davis, davis->params, now, &tp->snd_cwnd, &tp->snd_ssthresh);
+    davis_update_pacing_rate(sk);
 }
+EXPORT_SYMBOL_GPL(tcp_davis_set_state);
 
 
-u32 tcp_davis_undo_cwnd(struct sock *sk)
+// Restarts from idle aren't handled here, since the BDP is kept across
+// idle periods and STABLE restores cwnd from it on the next ACK.
+void tcp_davis_cwnd_event(struct sock *sk, enum tcp_ca_event ev)
 {
-    // TODO: Does this get called on ECN CE event?
-    struct davis *davis = inet_csk_ca(sk);
     struct tcp_sock *tp = tcp_sk(sk);
-    u64 now = davis_current_time(sk);
 
-    if (tcp_in_slow_start(tp)) {
-        davis->mode = DAVIS_DRAIN;
-        davis->trans_time = now;
+    if (!davis_params.ecn)
+        return;
+
+    // As a receiver, echo each CE mark on its own ACK rather than
+    // latching ECE until CWR as RFC 3168 does, so the sender can count
+    // them. Unlike DCTCP this doesn't force an immediate ACK when the
+    // CE state changes, so delayed ACKs smear the count a little.
+    if (ev == CA_EVENT_ECN_IS_CE)
+        tp->ecn_flags |= TCP_ECN_DEMAND_CWR;
+    else if (ev == CA_EVENT_ECN_NO_CE)
+        tp->ecn_flags &= ~TCP_ECN_DEMAND_CWR;
+}
+EXPORT_SYMBOL_GPL(tcp_davis_cwnd_event);
 
-        tp->snd_cwnd = MIN_CWND;
-        tp->snd_ssthresh = MIN_CWND;
-    }
 
-    return tp->snd_cwnd;
+// Called before cong_control for the same ACK. ECN is module-wide, so
+// this is safe on the handshake ACKs that come before init.
+void tcp_davis_in_ack_event(struct sock *sk, u32 flags)
+{
+    struct davis *davis = inet_csk_ca(sk);
+
+    davis->ece = davis_params.ecn && (flags & CA_ACK_ECE);
 }
-EXPORT_SYMBOL_GPL(tcp_davis_undo_cwnd);
+EXPORT_SYMBOL_GPL(tcp_davis_in_ack_event);
 
 
-static void davis_slow_start(struct sock *sk, u64 now)
+// The stack found the last loss episode spurious, from DSACKs or
+// timestamps.
+u32 tcp_davis_undo_cwnd(struct sock *sk)
 {
     struct davis *davis = inet_csk_ca(sk);
     struct tcp_sock *tp = tcp_sk(sk);
+    u64 now = davis_current_time(sk);
 
-    if (davis->mode == DAVIS_GAIN_1) {
-        if (now > davis->trans_time + GAIN_1_RTTS*davis->last_rtt) {
-            davis->mode = DAVIS_GAIN_2;
-            davis->trans_time = now;
-
-            davis->delivered_start = tp->delivered;
-            davis->delivered_start_time = tp->delivered_mstamp;
-        }
-    } else if (davis->mode == DAVIS_GAIN_2) {
-        if (now > davis->trans_time + GAIN_2_RTTS*davis->last_rtt) {
-            u32 diff_deliv = tp->delivered - davis->delivered_start;
-            u32 interval = tp->delivered_mstamp - davis->delivered_start_time;
-
-            if (interval > 0)
-                davis->bdp = DIV_ROUND_UP(diff_deliv*davis->min_rtt,
-                                          interval);
-
-            if (davis->bdp > davis->last_bdp) {
-                davis->mode = DAVIS_GAIN_1;
-                davis->trans_time = now;
-
-                tp->snd_cwnd = 3*davis->bdp/2;
-
-                davis->last_bdp = davis->bdp;
-            } else {
-                davis->mode = DAVIS_DRAIN;
-                davis->trans_time = now;
-
-                tp->snd_cwnd = MIN_CWND;
-                tp->snd_ssthresh = MIN_CWND;
-            }
-        }
-    } else {
-        davis_enter_slow_start(sk, now);
-    }
+    if (davis->params == NULL)
+        return tp->snd_cwnd;
+
+    davis_core_undo(davis, now, &tp->snd_cwnd);
+    davis_update_pacing_rate(sk);
+
+    return tp->snd_cwnd;
 }
+EXPORT_SYMBOL_GPL(tcp_davis_undo_cwnd);
 
 
 void tcp_davis_cong_control(struct sock *sk, const struct rate_sample *rs)
 {
     struct davis *davis = inet_csk_ca(sk);
     struct tcp_sock *tp = tcp_sk(sk);
+    struct davis_ack ack;
     u64 now = davis_current_time(sk);
+    bool new_bdp;
     s32 rtt;
 
+    // tcp_ack() runs on the SYN-ACK, or the ACK completing a passive
+    // open, before tcp_init_transfer() calls init. Those are left to the
+    // stack, and init starts from the handshake RTT.
+    if (davis->params == NULL)
+        return;
+
     // NOTE: This is a hack. rs->rtt_us is preffered because it will
     // always give the minimum RTT. However it only works well when
     // the RTT is primarily composed of propogation and queueing
@@ -304,97 +508,60 @@ void tcp_davis_cong_control(struct sock *sk, const struct rate_sample *rs)
     else
         rtt = tp->srtt_us;
 
-    if (rtt > 0) {
-        davis->last_rtt = rtt;
-
-        if (rtt < davis->min_rtt) {
-            davis->min_rtt = rtt;
-            davis->min_rtt_time = now;
-        }
-    }
-
-
-    if (tcp_in_slow_start(tp)) {
-        davis_slow_start(sk, now);
-    } else if (davis->mode == DAVIS_DRAIN) {
-        if (now > davis->trans_time + DRAIN_RTTS*davis->last_rtt) {
-            davis->mode = DAVIS_STABLE;
-            davis->trans_time = now;
-
-            tp->snd_cwnd = davis->bdp;
-        }
-    } else if (davis->mode == DAVIS_STABLE) {
-        if (now > davis->trans_time + davis->stable_rtts*davis->last_rtt) {
-            davis->mode = DAVIS_GAIN_1;
-            davis->trans_time = now;
-
-            tp->snd_cwnd = davis->bdp + davis->gain_cwnd;
-        }
-    } else if (davis->mode == DAVIS_GAIN_1) {
-        if (now > davis->trans_time + GAIN_1_RTTS*davis->last_rtt) {
-            davis->mode = DAVIS_GAIN_2;
-            davis->trans_time = now;
-
-            davis->delivered_start = tp->delivered;
-            davis->delivered_start_time = tp->delivered_mstamp;
-        }
-    } else if (davis->mode == DAVIS_GAIN_2) {
-        if (now > davis->trans_time + GAIN_2_RTTS*davis->last_rtt) {
-            u32 diff_deliv = tp->delivered - davis->delivered_start;
-            u32 interval = tp->delivered_mstamp - davis->delivered_start_time;
-
-            davis->last_bdp = davis->bdp;
-            if (interval > 0)
-                davis->bdp = DIV_ROUND_UP(diff_deliv*davis->min_rtt,
-                                          interval);
-
-            update_gain_cwnd(sk);
-
+    davis_fill_ack(sk, now, max_t(s32, rtt, 0), rs, &ack);
+    new_bdp = davis_core_on_ack(davis, davis->params, &ack,
+                                &tp->snd_cwnd, &tp->snd_ssthresh);
+    davis_update_pacing_rate(sk);
 
 #ifdef DAVIS_DEBUG
-            if (now > davis->last_debug_time + 250*USEC_PER_MSEC) {
-                davis->last_debug_time = now;
-
-                printk(KERN_DEBUG DAVIS_PRNT
-                       "bdp = %u, gain_cwnd = %u, min_rtt = %u, stable_rtts = %u\n",
-                       davis->bdp, davis->gain_cwnd, davis->min_rtt,
-                       davis->stable_rtts);
-            }
+    // Shared by all sockets, since there is no room left in
+    // icsk_ca_priv for a per-socket timestamp.
+    if (new_bdp && __ratelimit(&davis_debug_rs)) {
+        printk(KERN_DEBUG DAVIS_PRNT
+               "bdp = %u, gain_cwnd = %u, min_rtt = %u, stable_rtts = %u\n",
+               davis->bdp, davis->gain_cwnd, davis_min_rtt(davis),
+               davis->stable_rtts);
+    }
 #endif
+}
+EXPORT_SYMBOL_GPL(tcp_davis_cong_control);
 
-            if (now > davis->min_rtt_time + RTT_TIMEOUT_MS*USEC_PER_MSEC) {
-                davis->mode = DAVIS_DRAIN;
-                davis->trans_time = now;
-
-                tp->snd_cwnd = MIN_CWND;
-                davis->min_rtt = davis->last_rtt;
-                davis->min_rtt_time = now;
-            } else {
-                u32 rtt_diff = STABLE_RTTS_MAX - STABLE_RTTS_MIN;
-
-                davis->mode = DAVIS_STABLE;
-                davis->trans_time = now;
-
-                davis->stable_rtts = STABLE_RTTS_MIN;
-                davis->stable_rtts += prandom_u32_max(rtt_diff + 1);
 
-                tp->snd_cwnd = davis->bdp;
-            }
-        }
-    } else {
-        printk(KERN_ERR DAVIS_PRNT
-               "Got to undefined mode %d at time %llu\n",
-               davis->mode, now);
+size_t tcp_davis_get_info(struct sock *sk, u32 ext, int *attr,
+                          union tcp_cc_info *info)
+{
+    struct davis *davis = inet_csk_ca(sk);
+    struct tcp_davis_info *di = (struct tcp_davis_info *) info;
+
+    // ss -ti asks for VEGASINFO, and only decodes the attributes of the
+    // algorithms it knows, so answer it in Vegas's terms: the BDP in
+    // packets as the RTT count, and the last and min RTTs in us. ss
+    // takes tcpv_rtt for its send rate.
+    if (ext & (1 << (INET_DIAG_VEGASINFO - 1))) {
+        memset(&info->vegas, 0, sizeof(info->vegas));
+        info->vegas.tcpv_enabled = 1;
+        info->vegas.tcpv_rttcnt = davis->bdp;
+        info->vegas.tcpv_rtt = davis->last_rtt;
+        info->vegas.tcpv_minrtt = davis_min_rtt(davis);
+
+        *attr = INET_DIAG_VEGASINFO;
+        return sizeof(info->vegas);
+    }
 
-        davis->mode = DAVIS_DRAIN;
-        davis->trans_time = now;
+    if (!(ext & (1 << (INET_DIAG_INFO - 1))))
+        return 0;
 
-        tp->snd_cwnd = MIN_CWND;
-    }
+    memset(di, 0, sizeof(*di));
+    di->davis_mode = davis->mode;
+    di->davis_bdp = davis->bdp;
+    di->davis_gain_cwnd = davis->gain_cwnd;
+    di->davis_min_rtt = davis_min_rtt(davis);
+    di->davis_stable_rtts = davis->stable_rtts;
 
-    tp->snd_cwnd = clamp_t(u32, tp->snd_cwnd, MIN_CWND, MAX_TCP_WINDOW);
+    *attr = INET_DIAG_DAVISINFO;
+    return sizeof(*di);
 }
-EXPORT_SYMBOL_GPL(tcp_davis_cong_control);
+EXPORT_SYMBOL_GPL(tcp_davis_get_info);
 
 
 static struct tcp_congestion_ops tcp_davis __read_mostly = {
@@ -403,8 +570,12 @@ static struct tcp_congestion_ops tcp_davis __read_mostly = {
     .init         = tcp_davis_init,
     .release      = tcp_davis_release,
     .ssthresh     = tcp_davis_ssthresh,
+    .set_state    = tcp_davis_set_state,
     .undo_cwnd    = tcp_davis_undo_cwnd,
+    .cwnd_event   = tcp_davis_cwnd_event,
+    .in_ack_event = tcp_davis_in_ack_event,
     .cong_control = tcp_davis_cong_control,
+    .get_info     = tcp_davis_get_info,
 
     .owner        = THIS_MODULE,
     .name         = "davis",
@@ -412,14 +583,35 @@ static struct tcp_congestion_ops tcp_davis __read_mostly = {
 
 static int __init tcp_davis_register(void)
 {
+    const char *err = davis_params_check(&davis_params);
+    int ret;
+
     BUILD_BUG_ON(sizeof(struct davis) > ICSK_CA_PRIV_SIZE);
-    tcp_register_congestion_control(&tcp_davis);
-    return 0;
+    BUILD_BUG_ON(sizeof(struct tcp_davis_info) > sizeof(union tcp_cc_info));
+
+    if (err != NULL) {
+        davis_err("%s\n", err);
+        return -EINVAL;
+    }
+
+    if (davis_params.ecn)
+        tcp_davis.flags |= TCP_CONG_NEEDS_ECN;
+
+    ret = register_pernet_subsys(&davis_net_ops);
+    if (ret != 0)
+        return ret;
+
+    ret = tcp_register_congestion_control(&tcp_davis);
+    if (ret != 0)
+        unregister_pernet_subsys(&davis_net_ops);
+
+    return ret;
 }
 
 static void __exit tcp_davis_unregister(void)
 {
     tcp_unregister_congestion_control(&tcp_davis);
+    unregister_pernet_subsys(&davis_net_ops);
 }
 
 module_init(tcp_davis_register);
@@ -0,0 +1,117 @@
+#!/bin/sh
+#
+# Runs the BPF port of Davis over a veth pair between two network
+# namespaces, and the module too if it is loaded, then compares their
+# throughput and the average cost of each cong_control call. netem on
+# the sender side sets the RTT and rate. Build bpf/ first.
+#
+# The BPF cost comes from kernel.bpf_stats_enabled and the module's from
+# the ftrace function profiler, which adds some overhead of its own, so
+# only compare them roughly.
+
+set -e
+
+
+if [ $# -lt 1 ]
+then
+    echo "Usage: $0 OUTDIR [RATE] [RTT] [DURATION]"
+    exit 1
+fi
+
+OUTDIR=`realpath $1`
+RATE=${2:-1gbit}
+RTT=${3:-30ms}
+DURATION=${4:-20}
+
+SCRIPTDIR=`dirname $(realpath $0)`
+LOADER=$SCRIPTDIR/../bpf/davis_loader
+TRACING=/sys/kernel/tracing
+BPF_CC=bpf_davis_test
+SND=davis_snd
+RCV=davis_rcv
+
+
+cleanup() {
+    [ -n "$MAP_ID" ] && bpftool struct_ops unregister id $MAP_ID > /dev/null || true
+    [ -n "$PROFILING" ] && echo 0 > $TRACING/function_profile_enabled || true
+    ip netns del $SND 2> /dev/null || true
+    ip netns del $RCV 2> /dev/null || true
+}
+trap cleanup EXIT
+
+
+mkdir -p $OUTDIR
+
+ip netns add $SND
+ip netns add $RCV
+ip link add veth_snd netns $SND type veth peer name veth_rcv netns $RCV
+ip -n $SND addr add 10.77.0.1/24 dev veth_snd
+ip -n $RCV addr add 10.77.0.2/24 dev veth_rcv
+ip -n $SND link set veth_snd up
+ip -n $RCV link set veth_rcv up
+
+# All of the delay on the data path, so the ACKs aren't rate limited.
+ip netns exec $SND tc qdisc add dev veth_snd root netem delay $RTT rate $RATE limit 100000
+
+MAP_ID=`$LOADER -n $BPF_CC | sed -n 's/.*map id \([0-9]*\).*/\1/p'`
+if [ -z "$MAP_ID" ]
+then
+    echo "Failed to register $BPF_CC"
+    exit 1
+fi
+sysctl -q -w kernel.bpf_stats_enabled=1
+
+
+# Prints the average nanoseconds per call to the BPF program whose name
+# starts with $1, preferring the most recently loaded.
+bpf_cost() {
+    bpftool prog show --json | python3 -c "
+import json, sys
+progs = [p for p in json.load(sys.stdin) if p.get('name', '').startswith('$1')]
+p = max(progs, key=lambda p: p['id'])
+print(p['run_time_ns']/max(p['run_cnt'], 1))"
+}
+
+# Likewise for a kernel function, from the ftrace function profiler.
+function_cost() {
+    cat $TRACING/trace_stat/function* | awk -v f=$1 \
+        '$1 == f { hits += $2; us += $3 } END { print hits ? 1000*us/hits : 0 }'
+}
+
+run() {
+    ip netns exec $RCV iperf3 -s -D -1 > /dev/null 2>&1
+    sleep 1
+    ip netns exec $SND iperf3 -c 10.77.0.2 -t $DURATION -C $1 --json > $OUTDIR/$1.json
+}
+
+
+CCS=$BPF_CC
+run $BPF_CC
+echo "$BPF_CC `bpf_cost davis_cong_con` ns/ack" > $OUTDIR/cost.txt
+
+if grep -qw davis /proc/sys/net/ipv4/tcp_available_congestion_control
+then
+    CCS="$CCS davis"
+    echo tcp_davis_cong_control > $TRACING/set_ftrace_filter
+    echo 1 > $TRACING/function_profile_enabled
+    PROFILING=1
+    run davis
+    echo 0 > $TRACING/function_profile_enabled
+    PROFILING=
+    echo "davis `function_cost tcp_davis_cong_control` ns/ack" >> $OUTDIR/cost.txt
+    echo > $TRACING/set_ftrace_filter
+fi
+
+
+for cc in $CCS
+do
+    python3 -c "
+import json, sys
+end = json.load(open('$OUTDIR/$cc.json'))['end']
+used = end.get('sender_tcp_congestion', '$cc')
+rate = end['sum_sent']['bits_per_second']
+if used != '$cc' or rate <= 0:
+    sys.exit('$cc: ran with %s at %g bits/s' % (used, rate))
+print('$cc: %.1f Mbit/s, %d retransmits' % (rate/1e6, end['sum_sent']['retransmits']))"
+done
+cat $OUTDIR/cost.txt
@@ -2,6 +2,7 @@
 
 import argparse
 import math
+import os
 import re
 from subprocess import Popen, PIPE
 
@@ -20,6 +21,8 @@ parser.add_argument('--rate', type=str, default="10gbits",
                     help="Rate to limit traffic to in bits/s (default: %(default)s).")
 parser.add_argument('--rtt', type=str, default="30ms",
                     help="Emulated RTT (default: %(default)s).")
+parser.add_argument('--buffer', type=float, default=1.0,
+                    help="Bottleneck buffer in BDPs (default: %(default)s).")
 parser.add_argument('--max-buf-size', type=int, default=int(2**31 - 1),
                     help="Maximum size of buffers in bytes (default: %(default)s).")
 parser.add_argument('--min-mtu', type=int, default=576,
@@ -62,6 +65,11 @@ def getSysctl(attr):
         return (p.stdout.read().decode('utf-8').splitlines()[0], p)
 
 def setSysctl(attr, value):
+    # Most of net.core only exists in the initial network namespace.
+    if not os.path.exists("/proc/sys/" + attr.replace('.', '/')):
+        print("skipping {}, not in this network namespace".format(attr))
+        return
+
     run(["sysctl", "-qw", "{}={}".format(attr, value)])
 
 
@@ -96,9 +104,11 @@ if scale is not None:
 if rate is not None:
     bdp = min(args.max_buf_size, math.ceil(rate*rtt))
     bdp2 = min(args.max_buf_size, math.ceil(2*rate*rtt))
+    buf = min(args.max_buf_size, math.ceil(args.buffer*rate*rtt))
 else:
     bdp = args.max_buf_size
     bdp2 = args.max_buf_size
+    buf = args.max_buf_size
 
 
 setSysctl("net.core.rmem_default", bdp2)
@@ -121,7 +131,7 @@ run("tc filter add dev {} parent ffff: ".format(args.dev) +
 
 if rate is not None:
     run("tc qdisc add dev ifb0 root handle 1: tbf rate {}bit burst {} limit {}".format(
-        math.ceil(8*rate), math.ceil(bdp*args.burst_frac), bdp))
+        math.ceil(8*rate), math.ceil(bdp*args.burst_frac), buf))
 
     base = "parent 1:"
 else:
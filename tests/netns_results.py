@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import math
+import os
+import sys
+
+parser = argparse.ArgumentParser(
+    description="Summarize iperf3 JSON results as one CSV row per run.")
+parser.add_argument('infile', type=str, nargs='+',
+    help="iperf3 --json output of the sender, named after its congestion control.")
+parser.add_argument('--rate', type=str, default="",
+    help="Bottleneck rate, copied into each row.")
+parser.add_argument('--rtt', type=str, default="",
+    help="Round trip time, copied into each row.")
+parser.add_argument('--buffer', type=str, default="",
+    help="Bottleneck buffer in BDPs, copied into each row.")
+args = parser.parse_args()
+
+
+# Nearest rank, as the simulator's RTT histogram reports them.
+def quantile(xs, q):
+    if not xs:
+        return math.nan
+
+    return xs[min(len(xs) - 1, math.ceil(q*len(xs)) - 1)]
+
+def jain(xs):
+    sumSqr = sum(x**2 for x in xs)
+
+    return sum(xs)**2/(len(xs)*sumSqr) if sumSqr > 0 else 0
+
+
+failed = False
+
+# The same units as the simulator's sweep summary: bytes/s and seconds.
+print("cc,flows,rate,rtt,buffer,goodput,retransmits,rtt_p50,rtt_p99,jain")
+
+for f in sorted(args.infile):
+    cc = os.path.splitext(os.path.basename(f))[0]
+
+    try:
+        with open(f) as inp:
+            data = json.load(inp)
+
+        if 'error' in data:
+            raise ValueError(data['error'])
+
+        end = data['end']
+        used = end.get('sender_tcp_congestion', cc)
+        if used != cc:
+            raise ValueError("ran with {}".format(used))
+    except (OSError, ValueError, KeyError) as e:
+        print(f"{f}: {e}", file=sys.stderr)
+        failed = True
+        continue
+
+    flows = data['start']['test_start']['num_streams']
+    goodput = end['sum_received']['bits_per_second']/8
+    retransmits = end['sum_sent'].get('retransmits', 0)
+
+    # The sender reports each stream's smoothed RTT every interval.
+    rtts = sorted(s['rtt']/1e6 for i in data['intervals'] for s in i['streams']
+                  if 'rtt' in s)
+    rates = [s['receiver']['bits_per_second'] for s in end['streams']]
+
+    print(f"{cc},{flows},{args.rate},{args.rtt},{args.buffer},{goodput:f},"
+          f"{retransmits},{quantile(rtts, 0.5):f},{quantile(rtts, 0.99):f},"
+          f"{jain(rates):f}")
+
+sys.exit(1 if failed else 0)
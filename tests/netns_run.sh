@@ -0,0 +1,151 @@
+#!/bin/sh
+#
+# Runs the flow count x congestion control matrix on this host, each
+# cell over its own veth pair between two network namespaces, shaped by
+# netem_setup.py on the receiver's side. Every connection picks its
+# congestion control with TCP_CONGESTION (iperf3 -C), so nothing global
+# is switched and cells can run side by side with -j.
+#
+# Leaves each cell's iperf3 JSON in OUTDIR/N-flows/CC.json, as run.sh
+# does, and a summary of all of them in OUTDIR/results.csv.
+
+set -e
+
+
+usage() {
+    echo "Usage: $0 [-r RATE] [-d RTT] [-b BDPS] [-t DURATION] [-f FLOWS] [-c CCS] [-j JOBS] OUTDIR"
+    echo
+    echo "  -r RATE      Bottleneck rate in netem_setup.py's format (default 1Gbits)"
+    echo "  -d RTT       Round trip time (default 30ms)"
+    echo "  -b BDPS      Bottleneck buffer in BDPs (default 1)"
+    echo "  -t DURATION  Seconds per run (default 60)"
+    echo "  -f FLOWS     Flow counts (default \"1 2 5\")"
+    echo "  -c CCS       Congestion controls (default \"davis bbr reno vegas\")"
+    echo "  -j JOBS      Cells to run at once (default 1)"
+    echo
+    echo "Cells running at once share the host's CPUs, so only use -j when"
+    echo "rate times JOBS is well within what the host can forward."
+}
+
+RATE=1Gbits
+RTT=30ms
+BUFFER=1
+DURATION=60
+FLOWS="1 2 5"
+CCS="davis bbr reno vegas"
+JOBS=1
+
+while getopts "r:d:b:t:f:c:j:h" opt
+do
+    case $opt in
+        r ) RATE=$OPTARG;;
+        d ) RTT=$OPTARG;;
+        b ) BUFFER=$OPTARG;;
+        t ) DURATION=$OPTARG;;
+        f ) FLOWS=$OPTARG;;
+        c ) CCS=$OPTARG;;
+        j ) JOBS=$OPTARG;;
+        h ) usage; exit 0;;
+        * ) usage; exit 1;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ] || [ "$JOBS" -lt 1 ] || [ "$JOBS" -gt 250 ]
+then
+    usage
+    exit 1
+fi
+
+OUTDIR=`realpath $1`
+SCRIPTDIR=`dirname $(realpath $0)`
+PREFIX=davis_bench
+
+
+cleanup() {
+    for ns in `ip netns list | awk -v p=$PREFIX 'index($1, p) == 1 { print $1 }'`
+    do
+        ip netns del $ns 2> /dev/null || true
+    done
+}
+trap cleanup EXIT
+
+
+for cc in $CCS
+do
+    if ! grep -qw $cc /proc/sys/net/ipv4/tcp_available_congestion_control
+    then
+        modprobe tcp_$cc 2> /dev/null || true
+    fi
+
+    if ! grep -qw $cc /proc/sys/net/ipv4/tcp_available_congestion_control
+    then
+        echo "$cc isn't available, load its module first"
+        exit 1
+    fi
+done
+
+
+# Runs one cell in namespaces numbered $1, which also picks the subnet.
+run_cell() {
+    SND=${PREFIX}_snd$1
+    RCV=${PREFIX}_rcv$1
+    SND_IP=10.78.$1.1
+    RCV_IP=10.78.$1.2
+    DIR=$OUTDIR/$3-flows
+
+    ip netns add $SND
+    ip netns add $RCV
+    ip link add veth_snd netns $SND type veth peer name veth_rcv netns $RCV
+    ip -n $SND addr add $SND_IP/24 dev veth_snd
+    ip -n $RCV addr add $RCV_IP/24 dev veth_rcv
+    ip -n $SND link set veth_snd up
+    ip -n $RCV link set veth_rcv up
+
+    # netem_setup.py shapes what arrives at the receiver through ifb0,
+    # and sizes the socket buffers for twice the BDP. The sender's
+    # namespace needs the same buffers.
+    ip -n $RCV link add ifb0 type ifb
+    ip netns exec $RCV python3 $SCRIPTDIR/netem_setup.py veth_rcv \
+        --rate $RATE --rtt $RTT --buffer $BUFFER > $DIR/$2.setup.log
+    for mem in tcp_rmem tcp_wmem
+    do
+        ip netns exec $SND sysctl -qw \
+            net.ipv4.$mem="`ip netns exec $RCV sysctl -n net.ipv4.$mem`"
+    done
+
+    ip netns exec $RCV iperf3 -s -D -1 > /dev/null 2>&1
+    sleep 1
+    ip netns exec $SND iperf3 -c $RCV_IP -t $DURATION -P $3 -C $2 -i 0.1 \
+        --json > $DIR/$2.json || echo "$3 $2 flow(s) failed, see $DIR/$2.json"
+
+    ip netns del $SND
+    ip netns del $RCV
+}
+
+
+cell=0
+running=0
+for flows in $FLOWS
+do
+    mkdir -p $OUTDIR/$flows-flows
+
+    for cc in $CCS
+    do
+        cell=$((cell + 1))
+        run_cell $((cell % 250)) $cc $flows &
+
+        running=$((running + 1))
+        if [ $running -ge $JOBS ]
+        then
+            wait
+            running=0
+        fi
+    done
+done
+wait
+
+
+python3 $SCRIPTDIR/netns_results.py --rate $RATE --rtt $RTT --buffer $BUFFER \
+    $OUTDIR/*-flows/*.json > $OUTDIR/results.csv || echo "Some runs failed"
+cat $OUTDIR/results.csv
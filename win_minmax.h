@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copy of the kernel's windowed min/max filter
+ * (include/linux/win_minmax.h and lib/win_minmax.c, Kathleen Nichols'
+ * algorithm), built into every user of davis_core.h. lib/win_minmax.c
+ * only exports minmax_running_max() to modules, and nothing to BPF
+ * programs, so this is renamed davis_minmax_* to live alongside
+ * <linux/win_minmax.h> and vmlinux.h. The includer provides u32.
+ *
+ * The filter keeps the best, 2nd best and 3rd best samples of a
+ * window, each from a later subwindow, so that when the best sample
+ * ages out the next best takes over instead of the estimate jumping to
+ * whatever the latest sample was.
+ */
+
+#ifndef _WIN_MINMAX_H_
+#define _WIN_MINMAX_H_
+
+
+struct davis_minmax_sample {
+    u32 t;                      // Time of the measurement
+    u32 v;                      // Value measured
+};
+
+struct davis_minmax {
+    struct davis_minmax_sample s[3];
+};
+
+
+static inline u32 davis_minmax_get(const struct davis_minmax *m)
+{
+    return m->s[0].v;
+}
+
+
+static inline u32 davis_minmax_reset(struct davis_minmax *m, u32 t, u32 meas)
+{
+    struct davis_minmax_sample val = { .t = t, .v = meas };
+
+    m->s[2] = m->s[1] = m->s[0] = val;
+    return m->s[0].v;
+}
+
+
+// As time advances, update the 1st, 2nd and 3rd choices.
+static inline u32 davis_minmax_subwin_update(struct davis_minmax *m, u32 win,
+                                             const struct davis_minmax_sample *val)
+{
+    u32 dt = val->t - m->s[0].t;
+
+    if (dt > win) {
+        // Passed the entire window without a new best, so make the
+        // 2nd choice the new best and the 3rd the new 2nd. The latest
+        // sample may also be the new 3rd, or even 2nd, choice.
+        m->s[0] = m->s[1];
+        m->s[1] = m->s[2];
+        m->s[2] = *val;
+        if (val->t - m->s[0].t > win) {
+            m->s[0] = m->s[1];
+            m->s[1] = m->s[2];
+            m->s[2] = *val;
+        }
+    } else if (m->s[1].t == m->s[0].t && dt > win/4) {
+        // A quarter of the window has passed without a new 2nd
+        // choice, so take a 2nd choice from the 2nd quarter.
+        m->s[2] = m->s[1] = *val;
+    } else if (m->s[2].t == m->s[1].t && dt > win/2) {
+        // Likewise for the 3rd choice from the last half.
+        m->s[2] = *val;
+    }
+
+    return m->s[0].v;
+}
+
+
+// Check if a new measurement updates the 1st, 2nd or 3rd choice max.
+static inline u32 davis_minmax_running_max(struct davis_minmax *m, u32 win,
+                                           u32 t, u32 meas)
+{
+    struct davis_minmax_sample val = { .t = t, .v = meas };
+
+    if (val.v >= m->s[0].v || val.t - m->s[2].t > win)
+        return davis_minmax_reset(m, t, meas);
+
+    if (val.v >= m->s[1].v)
+        m->s[2] = m->s[1] = val;
+    else if (val.v >= m->s[2].v)
+        m->s[2] = val;
+
+    return davis_minmax_subwin_update(m, win, &val);
+}
+
+
+// Check if a new measurement updates the 1st, 2nd or 3rd choice min.
+static inline u32 davis_minmax_running_min(struct davis_minmax *m, u32 win,
+                                           u32 t, u32 meas)
+{
+    struct davis_minmax_sample val = { .t = t, .v = meas };
+
+    if (val.v <= m->s[0].v || val.t - m->s[2].t > win)
+        return davis_minmax_reset(m, t, meas);
+
+    if (val.v <= m->s[1].v)
+        m->s[2] = m->s[1] = val;
+    else if (val.v <= m->s[2].v)
+        m->s[2] = val;
+
+    return davis_minmax_subwin_update(m, win, &val);
+}
+
+
+#endif /* _WIN_MINMAX_H_ */